@@ -0,0 +1,57 @@
+#include "AccessedFields.h"
+
+#include <llvm/IR/GetElementPtrTypeIterator.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Operator.h>
+
+using namespace llvm;
+using namespace immutability;
+
+AccessedFields::AccessedFields(const Module &M) {
+  for (const Function &F : M) {
+    for (const Instruction &I : instructions(F)) {
+      if (isa<GetElementPtrInst>(I)) {
+        addGEP(I);
+      }
+      else if (auto EV = dyn_cast<ExtractValueInst>(&I)) {
+        addIndices(EV->getAggregateOperand()->getType(), EV->getIndices());
+      }
+      else if (auto IV = dyn_cast<InsertValueInst>(&I)) {
+        addIndices(IV->getAggregateOperand()->getType(), IV->getIndices());
+      }
+      // Constant expressions address fields of globals
+      for (const Value *Op : I.operands()) {
+        if (auto CE = dyn_cast<ConstantExpr>(Op)) {
+          if (CE->getOpcode() == Instruction::GetElementPtr) {
+            addGEP(*CE);
+          }
+        }
+      }
+    }
+  }
+}
+
+void AccessedFields::addIndices(Type *T, ArrayRef<unsigned> Indices) {
+  for (unsigned Index : Indices) {
+    if (auto ST = dyn_cast<StructType>(T)) {
+      Fields.insert(std::make_pair(ST, Index));
+    }
+    T = cast<CompositeType>(T)->getTypeAtIndex(Index);
+  }
+}
+
+void AccessedFields::addGEP(const User &GEP) {
+  for (auto It = gep_type_begin(GEP), E = gep_type_end(GEP); It != E; ++It) {
+    if (StructType *ST = It.getStructTypeOrNull()) {
+      if (auto CI = dyn_cast<ConstantInt>(It.getOperand())) {
+        Fields.insert(std::make_pair(ST, CI->getZExtValue()));
+        continue;
+      }
+      // Vector indices, any field may be meant
+      for (unsigned Index = 0; Index < ST->getNumElements(); ++Index) {
+        Fields.insert(std::make_pair(ST, Index));
+      }
+    }
+  }
+}
@@ -0,0 +1,36 @@
+#ifndef LLVM_ANALYSIS_IMMUTABILITY_ACCESSED_FIELDS_H
+#define LLVM_ANALYSIS_IMMUTABILITY_ACCESSED_FIELDS_H
+
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Module.h>
+
+namespace llvm {
+namespace immutability {
+
+/* The struct fields some instruction of the module addresses by index, with
+ * a getelementptr, extractvalue or insertvalue. A field outside of this set
+ * is only reached through byte offsets or as part of the whole object, so
+ * it can be tracked together with the other such fields.
+ */
+class AccessedFields {
+  DenseSet<std::pair<const StructType *, unsigned>> Fields;
+
+  void addIndices(Type *T, ArrayRef<unsigned> Indices);
+  void addGEP(const User &GEP);
+
+public:
+  explicit AccessedFields(const Module &M);
+
+  bool isAccessed(const StructType *T, unsigned Index) const {
+    return Fields.count(std::make_pair(T, Index)) > 0;
+  }
+  unsigned size() const {
+    return Fields.size();
+  }
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,238 @@
+#include "BlockStateCache.h"
+
+#include "Traversal.h"
+
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+
+using namespace llvm;
+using namespace immutability;
+
+namespace {
+
+const unsigned HashDepth = 3;
+const unsigned HashMaxElements = 16;
+
+hash_code hashNode(const NodePtr &N, unsigned Depth) {
+  hash_code H = hash_combine(N->getKind(), N->getType(), N->isThis(),
+                             N->isRead());
+  if (auto IN = dyn_cast<IntNode>(N.get())) {
+    return hash_combine(H, IN->getRange().hash());
+  }
+  if (Depth == 0) {
+    return H;
+  }
+  if (auto PN = dyn_cast<PointerNode>(N.get())) {
+    H = hash_combine(H, PN->getNullKind());
+    if (PN->hasPointee()) {
+      H = hash_combine(H, hashNode(PN->getPointee(), Depth - 1));
+    }
+  }
+  else if (N->isComposite()) {
+    unsigned NumElements = std::min(N->getNumElementSlots(),
+                                    HashMaxElements);
+    for (unsigned I = 0; I < NumElements; ++I) {
+      // Implicit this fields are skipped, hashing must not create them
+      if (N->hasMaterializedElement(I)) {
+        H = hash_combine(H, I, hashNode(N->getCompositeElement(I), Depth - 1));
+      }
+    }
+  }
+  return H;
+}
+
+}
+
+bool BlockStateCache::isCacheable(const BasicBlock *BB) {
+  // A callee can read and write through globals, which are not among the
+  // values the block reads. Intrinsics only touch their operands.
+  for (const Instruction &I : *BB) {
+    if ((isa<CallInst>(I) || isa<InvokeInst>(I)) && !isa<IntrinsicInst>(I)) {
+      return false;
+    }
+  }
+  // The bottom predecessors are kept in a single mask for the PHI nodes
+  unsigned NumPreds = 0;
+  for (const BasicBlock *Pred : predecessors(BB)) {
+    (void)Pred;
+    ++NumPreds;
+  }
+  return NumPreds <= 64;
+}
+
+namespace {
+
+// Mapped values the block reads, but does not define itself
+bool isOutsideRead(const BasicBlock *BB, const Value *V) {
+  if (auto I = dyn_cast<Instruction>(V)) {
+    return I->getParent() != BB;
+  }
+  return isa<Argument>(V) || isa<GlobalVariable>(V) || isa<ConstantExpr>(V);
+}
+
+// The rest of a state, which a hit takes from the new input
+bool isOther(const SmallPtrSetImpl<const Value *> &RootSet,
+             const BasicBlock *BB, const Value *V) {
+  if (RootSet.count(V)) {
+    return false;
+  }
+  if (auto I = dyn_cast<Instruction>(V)) {
+    return I->getParent() != BB;
+  }
+  return true;
+}
+
+}
+
+const std::vector<const Value *> &
+BlockStateCache::getBlockInputs(const BasicBlock *BB) {
+  auto &Inputs = BlockInputs[BB];
+  if (Inputs) {
+    return *Inputs;
+  }
+  Inputs = make_unique<std::vector<const Value *>>();
+  SmallPtrSet<const Value *, 16> Seen;
+  for (const Instruction &I : *BB) {
+    for (const Value *Op : I.operands()) {
+      if (isOutsideRead(BB, Op) && Seen.insert(Op).second) {
+        Inputs->push_back(Op);
+      }
+    }
+  }
+  return *Inputs;
+}
+
+BlockStateCache::Key BlockStateCache::getKey(const BasicBlock *BB,
+                                             Graph &Input,
+                                             uint64_t BottomPreds) {
+  Mutex.lock();
+  const std::vector<const Value *> &Inputs = getBlockInputs(BB);
+  Mutex.unlock();
+
+  hash_code H = hash_combine(BB, BottomPreds);
+  for (const Value *V : Inputs) {
+    if (NodePtr N = Input.findMapping(V)) {
+      H = hash_combine(H, V, hashNode(N, HashDepth));
+    }
+  }
+  return Key{BB, static_cast<unsigned>(H), BottomPreds};
+}
+
+GraphPtr BlockStateCache::lookup(const Key &K, const Graph &Input) {
+  Mutex.lock();
+  const std::vector<const Value *> &Inputs = getBlockInputs(K.BB);
+  Mutex.unlock();
+  if (Input.othersReachRoots(Inputs, K.BB)) {
+    return nullptr;
+  }
+
+  GraphPtr Ret;
+  Mutex.lock();
+  auto It = Entries.find(std::make_pair(K.BB, K.Hash));
+  if (It != Entries.end()) {
+    for (const Entry &E : It->second) {
+      if (E.BottomPreds == K.BottomPreds
+          && E.Input->equivalentOn(Input, Inputs)) {
+        Ret = E.Output->graftOthers(Input, Inputs, K.BB);
+        break;
+      }
+    }
+  }
+  Mutex.unlock();
+  return Ret;
+}
+
+void BlockStateCache::insert(const Key &K, GraphPtr Input, GraphPtr Output) {
+  Entry E{std::move(Input), std::move(Output), K.BottomPreds};
+  Mutex.lock();
+  auto &Bucket = Entries[std::make_pair(K.BB, K.Hash)];
+  if (Bucket.size() == MaxEntriesPerKey) {
+    Bucket.pop_front();
+  }
+  Bucket.push_back(std::move(E));
+  Mutex.unlock();
+}
+
+bool Graph::equivalentOn(const Graph &Other,
+                         ArrayRef<const Value *> Roots) const {
+  NodeSetT Checked;
+  NodeToNodeSetT ThisToOther;
+  for (const Value *V : Roots) {
+    NodePtr ThisN = findMapping(V);
+    NodePtr OtherN = Other.findMapping(V);
+    if (!ThisN || !OtherN) {
+      if (ThisN || OtherN) {
+        return false;
+      }
+      continue;
+    }
+    if (!equivalent(ThisN, OtherN, Checked, ThisToOther,
+                    const_cast<Graph &>(Other))) {
+      return false;
+    }
+  }
+  return equivalentAllEdges(ThisToOther, *this, Other);
+}
+
+// Whether the rest of the state shares a node with what the roots reach,
+// then the block may have changed it through the roots
+bool Graph::othersReachRoots(ArrayRef<const Value *> Roots,
+                             const BasicBlock *BB) const {
+  SmallPtrSet<const Value *, 16> RootSet(Roots.begin(), Roots.end());
+  DenseSet<const Node *> Read;
+  {
+    NodeWalker<> Walker;
+    for (const Value *V : Roots) {
+      if (NodePtr N = findMapping(V)) {
+        Walker.addRoot(N.get());
+      }
+    }
+    Walker.run([&Read](Node *N) {
+      Read.insert(N);
+      return true;
+    });
+  }
+
+  bool Reaches = false;
+  NodeWalker<> Walker;
+  for (auto &Entry : Mapping) {
+    if (isOther(RootSet, BB, Entry.first)) {
+      Walker.addRoot(Entry.second.get());
+    }
+  }
+  Walker.run([&](Node *N) {
+    if (Read.count(N)) {
+      Reaches = true;
+    }
+    return !Reaches;
+  });
+  return Reaches;
+}
+
+// This is the stored output, the block did not touch anything but the part
+// of its input the roots reach
+GraphPtr Graph::graftOthers(const Graph &Input, ArrayRef<const Value *> Roots,
+                            const BasicBlock *BB) const {
+  SmallPtrSet<const Value *, 16> RootSet(Roots.begin(), Roots.end());
+  auto IsOther = [&](const Value *V) { return isOther(RootSet, BB, V); };
+
+  GraphPtr Ret = clone();
+  Ret->eraseMappingsIf(IsOther);
+  NodeToNodeSetT InputToRet;
+  for (auto &Entry : Input.Mapping) {
+    if (IsOther(Entry.first)) {
+      Ret->addMapping(Entry.first, Input.clone(Entry.second, InputToRet));
+    }
+  }
+  cloneAllEdges(InputToRet);
+  for (auto &Entry : InputToRet) {
+    for (const NodePtr &N : Entry.second) {
+      Ret->MemAliases.addFrom(N, Input.MemAliases,
+                              const_cast<Node *>(Entry.first));
+    }
+  }
+  return Ret;
+}
@@ -0,0 +1,71 @@
+#ifndef LLVM_ANALYSIS_IMMUTABILITY_BLOCK_STATE_CACHE_H
+#define LLVM_ANALYSIS_IMMUTABILITY_BLOCK_STATE_CACHE_H
+
+#include "Graph.h"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/Hashing.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/Support/Mutex.h>
+
+#include <deque>
+
+namespace llvm {
+namespace immutability {
+
+/* Remembers, for each block of one method, the state before its terminator
+ * for the merged input states it has already been run with. The class
+ * fixpoint runs the same method over and over with initial states that only
+ * differ in a few fields, so most blocks see an input they have seen before.
+ *
+ * Only the part of the input the block can read has to match: the nodes
+ * reachable from the values it takes from outside of itself. The rest of a
+ * new input is grafted onto the stored output, as long as it shares no node
+ * with that part and so cannot have been touched by the block. Blocks that
+ * call a function are never cached, the callee reaches globals and whatever
+ * they point to without the block naming them.
+ *
+ * Comparing against a stored graph can materialize lazy this fields in it,
+ * so stored graphs are only ever touched with the mutex held.
+ */
+class BlockStateCache {
+public:
+  struct Key {
+    const BasicBlock *BB;
+    unsigned Hash;
+    uint64_t BottomPreds;
+  };
+
+private:
+  struct Entry {
+    GraphPtr Input;
+    GraphPtr Output;
+    uint64_t BottomPreds;
+  };
+
+  static const unsigned MaxEntriesPerKey = 4;
+
+  const Function *F;
+  sys::SmartMutex<false> Mutex;
+
+  // Behind a pointer so a reference stays valid when the map grows
+  DenseMap<const BasicBlock *, std::unique_ptr<std::vector<const Value *>>>
+    BlockInputs;
+  DenseMap<std::pair<const BasicBlock *, unsigned>, std::deque<Entry>> Entries;
+
+  const std::vector<const Value *> &getBlockInputs(const BasicBlock *BB);
+
+public:
+  BlockStateCache(const Function *F) : F(F) {}
+
+  static bool isCacheable(const BasicBlock *BB);
+
+  Key getKey(const BasicBlock *BB, Graph &Input, uint64_t BottomPreds);
+  GraphPtr lookup(const Key &K, const Graph &Input);
+  void insert(const Key &K, GraphPtr Input, GraphPtr Output);
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,73 @@
+#include "Graph.h"
+
+#include "Traversal.h"
+
+#include <llvm/ADT/Statistic.h>
+
+#define DEBUG_TYPE "immutability"
+
+using namespace llvm;
+using namespace immutability;
+
+STATISTIC(NumCollapsedStructs, "Number of wide struct nodes collapsed");
+STATISTIC(NumCollapsedFields, "Number of unaccessed struct fields summarized");
+
+void Graph::collapseWideStructs(const NodePtr &Root) {
+  if (!Q->Accessed || Q->WideStructFields == 0) {
+    return;
+  }
+  const AccessedFields &Accessed = *Q->Accessed;
+  std::vector<StructNode *> Wide;
+  NodeWalker<> Walker;
+  Walker.addRoot(Root.get());
+  Walker.run([&](Node *N) {
+    auto SN = dyn_cast<StructNode>(N);
+    if (SN && SN->getNumFields() >= Q->WideStructFields) {
+      Wide.push_back(SN);
+    }
+    return true;
+  });
+
+  // Unaddressed fields can still be reached through byte offsets and
+  // memcpy, so they share one summary node per field type instead of
+  // going away. Sharing is only done where the summary already stands for
+  // the field and nothing else holds the field's node.
+  for (StructNode *SN : Wide) {
+    auto T = cast<StructType>(SN->getType());
+    DenseMap<const Type *, NodePtr> Summaries;
+    unsigned NumShared = 0;
+    for (unsigned I = 0; I < SN->getNumFields(); ++I) {
+      // Base class subobjects are reached through supertype indices
+      Type *FieldTy = T->getElementType(I);
+      if (!SN->hasElement(I) || FieldTy->isStructTy()
+          || Accessed.isAccessed(T, I)) {
+        continue;
+      }
+      NodePtr Field = SN->getElement(I);
+      if (Field.use_count() > 2 || Field->isInterned()) {
+        continue;
+      }
+      NodePtr &Summary = Summaries[FieldTy];
+      if (!Summary) {
+        Summary = Field;
+        continue;
+      }
+      if (Summary == Field) {
+        continue;
+      }
+      NodeSetT Checked;
+      NodeToNodeSetT FieldToSummary;
+      if (!moreSpecific(Field, Summary, Checked, FieldToSummary, *this)
+          || !moreSpecificAllEdges(FieldToSummary, *this, *this)) {
+        continue;
+      }
+      Summary->markIsSummary();
+      SN->setField(I, Summary);
+      ++NumShared;
+    }
+    if (NumShared > 0) {
+      ++NumCollapsedStructs;
+      NumCollapsedFields += NumShared;
+    }
+  }
+}
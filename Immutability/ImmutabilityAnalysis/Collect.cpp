@@ -0,0 +1,76 @@
+#include "Graph.h"
+
+#include "Traversal.h"
+
+#include <llvm/ADT/Statistic.h>
+
+#define DEBUG_TYPE "immutability"
+
+using namespace llvm;
+using namespace immutability;
+
+STATISTIC(NumCollections, "Number of graph garbage collections");
+STATISTIC(NumLiveNodes, "Number of live nodes seen by garbage collection");
+STATISTIC(NumDeadEdges, "Number of copy and weak edges to dead nodes removed");
+STATISTIC(NumDeadAliases, "Number of alias table entries for dead nodes removed");
+
+namespace {
+
+// Nodes a this edge points to stay with their source, SubStruct comes with
+// NodeChildren
+struct LiveChildren {
+  template <typename PushT>
+  void operator()(Node *N, PushT Push) const {
+    NodeChildren()(N, Push);
+    for (const NodePtr &TN : N->getThisEdges()) {
+      Push(TN.get());
+    }
+  }
+};
+
+}
+
+/* Only unlinks dead nodes from what is live: their copy and weak edges,
+ * alias entries and reverse mappings. Dead nodes that own each other in a
+ * cycle keep their shared pointers and are never freed, this does not
+ * reclaim them.
+ */
+void Graph::collectGarbage() {
+  if (IsBottom) {
+    return;
+  }
+  ++NumCollections;
+
+  NodeWalker<LiveChildren> Walker;
+  for (auto &Entry : Mapping) {
+    Walker.addRoot(Entry.second.get());
+  }
+  if (Return) {
+    Walker.addRoot(Return.get());
+  }
+  MemAliases.forEachThisNode([&Walker](Node *N) { Walker.addRoot(N); });
+
+  std::vector<Node *> LiveNodes;
+  Walker.run([&LiveNodes](Node *N) {
+    LiveNodes.push_back(N);
+    return true;
+  });
+  NumLiveNodes += LiveNodes.size();
+
+  DenseSet<const Node *> Live;
+  Live.reserve(LiveNodes.size());
+  for (Node *N : LiveNodes) {
+    Live.insert(N);
+  }
+  for (Node *N : LiveNodes) {
+    NumDeadEdges += N->pruneEdges(Live);
+  }
+  NumDeadAliases += MemAliases.prune(Live);
+
+  for (auto It = ReverseMapping.begin(), E = ReverseMapping.end(); It != E;) {
+    auto Cur = It++;
+    if (!Live.count(Cur->first)) {
+      ReverseMapping.erase(Cur);
+    }
+  }
+}
@@ -0,0 +1,164 @@
+#ifndef LLVM_ANALYSIS_IMMUTABILITY_EDGE_SET_H
+#define LLVM_ANALYSIS_IMMUTABILITY_EDGE_SET_H
+
+#include <llvm/ADT/SmallVector.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+namespace llvm {
+namespace immutability {
+
+// Same order as std::set<std::shared_ptr<T>>
+struct PointerOrder {
+  template <typename L, typename R>
+  bool operator()(const L &LHS, const R &RHS) const {
+    return std::less<const void *>()(LHS.get(), RHS.get());
+  }
+};
+
+// Same order as std::owner_less, works on weak and shared pointers alike
+struct OwnerOrder {
+  template <typename L, typename R>
+  bool operator()(const L &LHS, const R &RHS) const {
+    return LHS.owner_before(RHS);
+  }
+};
+
+/* A set of node edges kept as a sorted inline vector. Most nodes have at
+ * most a couple of edges of each kind, so this avoids a tree node per edge
+ * and lets lookups compare owners without locking weak pointers. Expired
+ * weak entries are dropped by compact(), which insert() also runs before
+ * growing the vector.
+ */
+template <typename PtrT, typename OrderT, unsigned N = 2>
+class EdgeSet {
+  typedef SmallVector<PtrT, N> VectorT;
+  VectorT Edges;
+
+  template <typename KeyT>
+  typename VectorT::iterator lowerBound(const KeyT &K) {
+    return std::lower_bound(Edges.begin(), Edges.end(), K, OrderT());
+  }
+  template <typename KeyT>
+  typename VectorT::const_iterator lowerBound(const KeyT &K) const {
+    return std::lower_bound(Edges.begin(), Edges.end(), K, OrderT());
+  }
+  template <typename It, typename KeyT>
+  bool matches(It I, const KeyT &K) const {
+    return I != Edges.end() && !OrderT()(K, *I);
+  }
+
+public:
+  typedef typename VectorT::const_iterator iterator;
+  typedef typename VectorT::const_iterator const_iterator;
+  typedef PtrT value_type;
+
+  const_iterator begin() const { return Edges.begin(); }
+  const_iterator end() const { return Edges.end(); }
+  size_t size() const { return Edges.size(); }
+  bool empty() const { return Edges.empty(); }
+  void clear() { Edges.clear(); }
+
+  template <typename KeyT>
+  size_t count(const KeyT &K) const {
+    return matches(lowerBound(K), K) ? 1 : 0;
+  }
+  template <typename KeyT>
+  const_iterator find(const KeyT &K) const {
+    auto I = lowerBound(K);
+    return matches(I, K) ? I : end();
+  }
+
+  std::pair<const_iterator, bool> insert(const PtrT &P) {
+    auto I = lowerBound(P);
+    if (matches(I, P)) {
+      return std::make_pair(const_iterator(I), false);
+    }
+    if (Edges.size() == Edges.capacity() && compact()) {
+      I = lowerBound(P);
+    }
+    I = Edges.insert(I, P);
+    return std::make_pair(const_iterator(I), true);
+  }
+  template <typename KeyT>
+  size_t erase(const KeyT &K) {
+    auto I = lowerBound(K);
+    if (!matches(I, K)) {
+      return 0;
+    }
+    Edges.erase(I);
+    return 1;
+  }
+
+  // Drops the edges matching Pred, returns how many were dropped
+  template <typename PredT>
+  unsigned eraseIf(PredT Pred) {
+    auto NewEnd = std::remove_if(Edges.begin(), Edges.end(), Pred);
+    unsigned Erased = Edges.end() - NewEnd;
+    Edges.erase(NewEnd, Edges.end());
+    return Erased;
+  }
+
+  // Drops edges to nodes that no longer exist, returns if any were dropped
+  bool compact() {
+    return eraseIf([](const PtrT &P) { return isExpired(P); }) > 0;
+  }
+
+private:
+  template <typename T>
+  static bool isExpired(const std::weak_ptr<T> &P) { return P.expired(); }
+  template <typename T>
+  static bool isExpired(const std::shared_ptr<T> &) { return false; }
+};
+
+/* Iterates the nodes of a weak edge set that are still alive */
+template <typename SetT>
+class LiveNodeRange {
+public:
+  typedef typename SetT::value_type::element_type NodeT;
+
+  class iterator {
+    typename SetT::const_iterator It, End;
+    std::shared_ptr<NodeT> Current;
+
+    void settle() {
+      for (; It != End; ++It) {
+        Current = It->lock();
+        if (Current) {
+          return;
+        }
+      }
+      Current.reset();
+    }
+
+  public:
+    iterator(typename SetT::const_iterator I, typename SetT::const_iterator E)
+        : It(I), End(E) {
+      settle();
+    }
+    const std::shared_ptr<NodeT> &operator*() const { return Current; }
+    iterator &operator++() {
+      ++It;
+      settle();
+      return *this;
+    }
+    bool operator==(const iterator &O) const { return It == O.It; }
+    bool operator!=(const iterator &O) const { return It != O.It; }
+  };
+
+private:
+  const SetT &S;
+
+public:
+  explicit LiveNodeRange(const SetT &S) : S(S) {}
+
+  iterator begin() const { return iterator(S.begin(), S.end()); }
+  iterator end() const { return iterator(S.end(), S.end()); }
+};
+
+}
+}
+
+#endif
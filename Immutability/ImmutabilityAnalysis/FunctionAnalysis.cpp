@@ -63,6 +63,8 @@ BasicBlock::const_iterator getLastIter(const BasicBlock *BB) {
 }
 
 void FunctionAnalysis::addToWorklist(const BasicBlock *BB) {
+  // The fork block only runs in the forks, see getForkResult
+  if (BB == ForkBlock) { return; }
   for (auto Entry : Worklist) {
     if (BB == Entry) { return; }
   }
@@ -101,6 +103,17 @@ const GraphPtr &FunctionAnalysis::getPredOrInitialState(BasicBlockEdge Edge) {
   }
 }
 
+unsigned FunctionAnalysis::getStateHash(BasicBlockEdge Edge) {
+  auto It = StateHashes.find(Edge);
+  if (It != StateHashes.end()) {
+    return It->second;
+  }
+  // Edge states copied into a fork are hashed on first use
+  unsigned Hash = States[Edge]->hash(CurrentFunction);
+  StateHashes[Edge] = Hash;
+  return Hash;
+}
+
 bool FunctionAnalysis::shouldWait(const BasicBlock *BB) {
   for (const_pred_iterator PI = pred_begin(BB), E = pred_end(BB); PI != E;
        ++PI) {
@@ -140,13 +153,28 @@ bool FunctionAnalysis::allBottomOrNull(const BasicBlock *BB) {
   return true;
 }
 
+uint64_t FunctionAnalysis::deriveStamp(std::vector<uint64_t> Key) {
+  uint64_t &Stamp = DerivedStamps[std::move(Key)];
+  if (Stamp == 0) {
+    Stamp = Graph::createStamp();
+  }
+  return Stamp;
+}
+
 GraphPtr FunctionAnalysis::merge(const BasicBlock *BB) {
   if (hasNoPredecessors(BB)) {
-    return Initial->clone();
-  }
-  GraphPtr Ret;
+    GraphPtr Ret = Initial->clone();
+    Ret->setStamp(Initial->getStamp());
+    return std::move(Ret);
+  }
+  SmallVector<const Graph *, 4> Inputs;
+  // The PHI nodes depend on which predecessors are bottom
+  uint64_t BottomPreds = 0;
+  unsigned Index = 0;
+  bool KnownStamps = true;
+  SmallVector<uint64_t, 4> Stamps;
   for (const_pred_iterator PI = pred_begin(BB), E = pred_end(BB); PI != E;
-       ++PI) {
+       ++PI, ++Index) {
     const BasicBlock *PredBB = *PI;
 
     auto Edge = BasicBlockEdge(PredBB, BB);
@@ -158,32 +186,83 @@ GraphPtr FunctionAnalysis::merge(const BasicBlock *BB) {
 
     const GraphPtr &PredState = getPredOrInitialState(Edge);
     if (PredState->isBottom()) {
+      if (Index < 64) {
+        BottomPreds |= uint64_t(1) << Index;
+      }
+      else {
+        KnownStamps = false;
+      }
       continue;
     }
 
-    if (Ret == nullptr) { Ret = PredState->clone(); }
-    else                { Ret = Graph::merge(*Ret, *PredState); }
+    uint64_t Stamp = PredState->getStamp();
+    if (Stamp == 0) {
+      KnownStamps = false;
+    }
+    else if (is_contained(Stamps, Stamp)) {
+      // Already merged an equivalent state
+      continue;
+    }
+    else {
+      Stamps.push_back(Stamp);
+    }
+
+    Inputs.push_back(PredState.get());
   }
 
   // No predecessor state contributed to the final merge state, this means all
   // the predecessors were bottom, so just set the final merge state to bottom
-  if (Ret == nullptr) {
+  GraphPtr Ret;
+  if (Inputs.empty()) {
     Ret = Graph::createBottom(Q);
   }
+  else {
+    Ret = Graph::mergeDistinct(Inputs);
+    // A block input also depends on which predecessors were bottom
+    Ret->setStamp(0);
+    if (KnownStamps) {
+      std::sort(Stamps.begin(), Stamps.end());
+      std::vector<uint64_t> Key = {SK_MERGE, reinterpret_cast<uintptr_t>(BB),
+                                   BottomPreds};
+      Key.insert(Key.end(), Stamps.begin(), Stamps.end());
+      Ret->setStamp(deriveStamp(std::move(Key)));
+    }
+  }
 
   return std::move(Ret);;
 }
 
+uint64_t FunctionAnalysis::getBottomPreds(const BasicBlock *BB) {
+  uint64_t Mask = 0;
+  unsigned Index = 0;
+  for (const BasicBlock *PredBB : predecessors(BB)) {
+    const GraphPtr &PredState = getPredOrInitialState(BasicBlockEdge(PredBB, BB));
+    if (PredState->isBottom()) {
+      Mask |= uint64_t(1) << Index;
+    }
+    ++Index;
+  }
+  return Mask;
+}
+
 GraphPtr FunctionAnalysis::getCurrentState(BasicBlockEdge Edge,
-                                           const Instruction &I) {
+                                           const Instruction &I,
+                                           bool IsLastUse) {
   if (auto BI = dyn_cast<BranchInst>(&I)) {
-    if (BI->isConditional()) {
+    if (BI->isConditional() && Q->isPathSensitive()) {
       assert(BI->getNumSuccessors() == 2
              && "Conditional branch should only have a true and false branch");
       // The first successor is the true branch, if it's the same as the branch
       // target we're assuming the condition is true
-      GraphPtr CurrentState = MutableState->clone();
+      uint64_t Stamp = MutableState->getStamp();
+      GraphPtr CurrentState = IsLastUse ? std::move(MutableState)
+                                        : MutableState->clone();
       bool B = BI->getSuccessor(0) == Edge.getEnd();
+      CurrentState->setStamp(0);
+      if (Stamp != 0) {
+        CurrentState->setStamp(deriveStamp(
+            {SK_REFINE, reinterpret_cast<uintptr_t>(Edge.getEnd()), B, Stamp}));
+      }
 //errs() << "BEFORE Refine\n\n\n";
 //CurrentState->dump();
       CurrentState->refineBool(BI->getCondition(), B);
@@ -194,7 +273,31 @@ GraphPtr FunctionAnalysis::getCurrentState(BasicBlockEdge Edge,
     }
   }
 
-  return MutableState->clone();
+  if (IsLastUse) {
+    return std::move(MutableState);
+  }
+  GraphPtr CurrentState = MutableState->clone();
+  CurrentState->setStamp(MutableState->getStamp());
+  return std::move(CurrentState);
+}
+
+// Depends only on the edge, so equivalent inputs stay equivalent and the
+// stamp carries over
+void FunctionAnalysis::pruneDeadValues(BasicBlockEdge Edge, Graph &State) {
+  if (State.isBottom()) {
+    return;
+  }
+  const Liveness &L = Q->getLiveness(CurrentFunction);
+  const ValueSlots &Slots = L.getValueSlots();
+  BitVector Live;
+  L.getLiveOnEdge(Edge.getStart(), Edge.getEnd(), Live);
+  State.eraseMappingsIf([&](const Value *V) {
+    auto I = dyn_cast<Instruction>(V);
+    if (!I || I->getFunction() != CurrentFunction) {
+      return false;
+    }
+    return !Live.test(Slots.getSlot(I));
+  });
 }
 
 bool FunctionAnalysis::isRecursive(const Function *F) const {
@@ -307,7 +410,7 @@ void FunctionAnalysis::handleCall(const Instruction *CI, const Function *F) {
     NodePtr Orig = MutableState->getMapping(CS.getArgOperand(I));
     NodePtr N = Orig->copy();
         // Need to create edges that include this copy now
-        for (auto CopyN : N->getCopyNodes()) {
+        for (const NodePtr &CopyN : N->copyNodes()) {
           CopyN->addCopyEdge(N);
         }
         /*
@@ -320,7 +423,10 @@ void FunctionAnalysis::handleCall(const Instruction *CI, const Function *F) {
         //if (MutableState->GlobalTracker.hasNode(Orig)) {
         //  MutableState->GlobalTracker.addNode(N);
         //}
-        Node::addCopyEdge(Orig, N);
+        // Nothing can change a shared constant, it needs no edge back
+        if (!Orig->isInterned()) {
+          Node::addCopyEdge(Orig, N);
+        }
         /*
         for (auto &Entry : MutableState->CallAliases) {
           auto &Tracker = Entry.second;
@@ -350,11 +456,13 @@ void FunctionAnalysis::handleCall(const Instruction *CI, const Function *F) {
     ++I;
   }
 
-  FunctionAnalysis FA(Q, this, F, MutableState, FirstMethod);
+  // The callee starts from the current state, which is replaced by the result
+  FunctionAnalysis FA(Q, this, F, std::move(MutableState), FirstMethod);
 
   auto Result = FA.getResult();
   if (Result->isBottom()) {
-    MutableState->markIsBottom();
+    MutableState = std::move(Result);
+    MutableState->setFirstMethod(FirstMethod);
     MutableState->eraseRelevant(F);
     return;
   }
@@ -384,6 +492,9 @@ void FunctionAnalysis::handleCall(const Instruction *CI, const Function *F) {
   MutableState->setFirstMethod(FirstMethod);
 
   MutableState->eraseRelevant(F);
+  if (Q->CollectGarbage) {
+    MutableState->collectGarbage();
+  }
 }
 
 void FunctionAnalysis::handlePHINode(const PHINode &I) {
@@ -429,6 +540,8 @@ void FunctionAnalysis::handleTerminator(const Instruction &I) {
     return handleExitTerminator(I);
   }
 
+  // The block is done with its state after the last successor takes it
+  int Last = I.getNumSuccessors() - 1;
   for (int i=0; i<I.getNumSuccessors(); i++) {
     const BasicBlock *SuccBB = I.getSuccessor(i);
     // Skip unreachable blocks
@@ -437,16 +550,34 @@ void FunctionAnalysis::handleTerminator(const Instruction &I) {
     }
     BasicBlockEdge Edge(BB, SuccBB);
     auto &PreviousState = getPredOrNullState(Edge);
-    GraphPtr CurrentState = getCurrentState(Edge, I);
+    GraphPtr CurrentState = getCurrentState(Edge, I, i == Last);
+    if (!Q->tracksIntRanges()) {
+      CurrentState->dropIntRanges();
+    }
+    if (Q->PruneDeadValues) {
+      pruneDeadValues(Edge, *CurrentState);
+    }
 
     if (PreviousState.get() != nullptr) {
-      if (!(PreviousState->equivalent(*CurrentState, CurrentFunction))) {
+      uint64_t PreviousStamp = PreviousState->getStamp();
+      if (PreviousStamp != 0 && PreviousStamp == CurrentState->getStamp()) {
+        // Computed from the same inputs, the stored state stays
+        continue;
+      }
+      unsigned CurrentHash = CurrentState->hash(CurrentFunction);
+      if (getStateHash(Edge) != CurrentHash
+          || !(PreviousState->equivalent(*CurrentState, CurrentFunction))) {
         addToWorklist(SuccBB);
       }
+      else {
+        CurrentState->setStamp(PreviousStamp);
+      }
+      StateHashes[Edge] = CurrentHash;
     }
     else {
         //assert(PreviousState.get() == nullptr);
       addToWorklist(SuccBB);
+      StateHashes[Edge] = CurrentState->hash(CurrentFunction);
     }
 
     States[Edge] = std::move(CurrentState);
@@ -468,7 +599,7 @@ GraphPtr FunctionAnalysis::getResult() {
   }
 
   //NodeToNodeSetT StateToPartial;
-  bool Initialized = false;
+  SmallVector<GraphPtr *, 4> Exits;
   for (auto &Entry : ExitStates) {
     if (isa<UnreachableInst>(Entry.first)) {
       continue;
@@ -493,30 +624,28 @@ GraphPtr FunctionAnalysis::getResult() {
       continue;
     }
 
-    if (!Initialized) {
-      Result = State->clone();
-      if (!IsVoid) {
-          assert(ReturnValue);
-        Result->addReturn(ReturnValue);
-      }
-      Initialized = true;
-    }
-    else {
-      GraphPtr Next = State->clone();
-      if (!IsVoid) {
-          assert(ReturnValue);
-        Next->addReturn(ReturnValue);
-      }
-      Result = Graph::merge(*Result, *Next);
+    if (!IsVoid) {
+        assert(ReturnValue);
+      State->addReturn(ReturnValue);
     }
+    State->setStamp(0);
+    Exits.push_back(&State);
   }
-  if (!Initialized) {
+  if (Exits.empty()) {
     // TODO2018: This shouldn't be hit
     // CurrentFunction->print(errs());
     Result = Graph::createBottom(Q);
-    Initialized = true;
   }
-  assert(Initialized && "Result requires one valid exit state");
+  else if (Exits.size() == 1) {
+    Result = std::move(*Exits.front());
+  }
+  else {
+    SmallVector<const Graph *, 4> Inputs;
+    for (GraphPtr *State : Exits) {
+      Inputs.push_back(State->get());
+    }
+    Result = Graph::mergeDistinct(Inputs);
+  }
   //Result->verify();
 
   // WriteGraph(llvm::errs(), &*Result);
@@ -524,7 +653,34 @@ GraphPtr FunctionAnalysis::getResult() {
   return std::move(Result);
 }
 
-void FunctionAnalysis::run() {
+FunctionAnalysis::FunctionAnalysis(const FunctionAnalysis &Prefix,
+                                   const BasicBlockEdge *E)
+    : Q(Prefix.Q), ParentAnalysis(Prefix.ParentAnalysis),
+      CurrentFunction(Prefix.CurrentFunction), IgnoredEdge(E),
+      ForkBlock(nullptr), FirstMethod(Prefix.FirstMethod),
+      Cache(Prefix.Cache), Scalars(Prefix.Scalars) {
+  const BasicBlock *BB = Prefix.ForkBlock;
+  assert(BB && "Forking requires a fork block");
+  assert(E->getEnd() == BB && "Ignored edge must end in the fork block");
+  Initial = Prefix.Initial->clone();
+  Initial->setStamp(Prefix.Initial->getStamp());
+  for (const BasicBlock *PredBB : predecessors(BB)) {
+    BasicBlockEdge Edge(PredBB, BB);
+    auto It = Prefix.States.find(Edge);
+    if (It != Prefix.States.end()) {
+      States[Edge] = It->second->clone();
+      States[Edge]->setStamp(It->second->getStamp());
+    }
+  }
+  run(BB);
+}
+
+GraphPtr FunctionAnalysis::getForkResult(const BasicBlockEdge &E) const {
+  FunctionAnalysis Fork(*this, &E);
+  return Fork.getResult();
+}
+
+void FunctionAnalysis::run(const BasicBlock *Start) {
 #if DEBUG_FUNCTION_ANALYSIS
   dbgs() << "RUN: Function " << CurrentFunction->getName() << '\n';
 #endif
@@ -537,7 +693,12 @@ void FunctionAnalysis::run() {
 
   std::deque<BasicBlock::const_iterator> InstWorklist;
 
-  addToWorklist(&CurrentFunction->getEntryBlock());
+  // Merged input of the current block, kept to fill the block state cache
+  GraphPtr CacheInput;
+  BlockStateCache::Key CacheKey;
+  uint64_t InputStamp = 0;
+
+  addToWorklist(Start);
 
   while (!(Worklist.empty() && InstWorklist.empty())) {
     if (InstWorklist.empty()) {
@@ -566,19 +727,54 @@ void FunctionAnalysis::run() {
       }
       MutableState->setFirstMethod(FirstMethod);
 
+      InputStamp = MutableState->getStamp();
+      if (InputStamp != 0) {
+        uint64_t &LastStamp = BlockInputStamps[BB];
+        if (LastStamp == InputStamp) {
+          // The edge states from the last run of this input are still there
+          continue;
+        }
+        LastStamp = InputStamp;
+      }
+
       if (MutableState->isBottom()) {
         // Skip all analysis and just handle the last instruction
         InstWorklist.push_back(getLastIter(BB));
+        continue;
       }
-      else {
-        InstWorklist.push_back(getFirstIter(BB));
+
+      if (Cache && BlockStateCache::isCacheable(BB)) {
+        CacheKey = Cache->getKey(BB, *MutableState, getBottomPreds(BB));
+        if (GraphPtr Cached = Cache->lookup(CacheKey, *MutableState)) {
+          // Seen this input before, only the terminator needs to run
+          MutableState = std::move(Cached);
+          MutableState->setFirstMethod(FirstMethod);
+          InstWorklist.push_back(getLastIter(BB));
+          continue;
+        }
+        CacheInput = MutableState->clone();
       }
+
+      InstWorklist.push_back(getFirstIter(BB));
       continue;
     }
 
     auto Iter = InstWorklist.back();
     InstWorklist.pop_back();
     const Instruction &I = *Iter;
+
+    if (Q->RecursiveDepthLimit > 0 && I.isTerminator()) {
+      MutableState->limitRecursiveDepth(Q->RecursiveDepthLimit);
+    }
+    if (Q->CollectGarbage && I.isTerminator()) {
+      MutableState->collectGarbage();
+    }
+    if (CacheInput && I.isTerminator()) {
+      if (!MutableState->isBottom()) {
+        Cache->insert(CacheKey, std::move(CacheInput), MutableState->clone());
+      }
+      CacheInput.reset();
+    }
     //assert(!isa<UnreachableInst>(I));
 
     // I.print(errs()); errs() << '\n';
@@ -660,7 +856,11 @@ void FunctionAnalysis::run() {
       }
     }
     else if (!IsVTableInst) {
-      if (isa<PHINode>(&I)) {
+      if (Scalars && Scalars->isUntracked(I)) {
+        MutableState->addSharedMapping(&I,
+                                       Node::getUntrackedScalar(I.getType()));
+      }
+      else if (isa<PHINode>(&I)) {
         handlePHINode(cast<PHINode>(I));
       }
       else if (isa<LandingPadInst>(I)) {
@@ -680,6 +880,11 @@ void FunctionAnalysis::run() {
     }
 
     if (I.isTerminator()) {
+      MutableState->setStamp(0);
+      if (InputStamp != 0) {
+        MutableState->setStamp(deriveStamp(
+            {SK_BLOCK, reinterpret_cast<uintptr_t>(I.getParent()), InputStamp}));
+      }
       handleTerminator(cast<Instruction>(I));
     }
     else {
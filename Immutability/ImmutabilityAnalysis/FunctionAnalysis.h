@@ -1,6 +1,7 @@
 #ifndef LLVM_ANALYSIS_IMMUTABILITY_FUNCTION_ANALYSIS_H
 #define LLVM_ANALYSIS_IMMUTABILITY_FUNCTION_ANALYSIS_H
 
+#include "BlockStateCache.h"
 #include "Graph.h"
 #include "ImmutabilityAnalysis.h"
 
@@ -8,6 +9,7 @@
 #include <llvm/IR/Dominators.h>
 
 #include <deque>
+#include <map>
 
 namespace llvm {
 namespace immutability {
@@ -27,6 +29,10 @@ private:
   const Function *CurrentFunction;
   const Function *FirstMethod;
   const BasicBlockEdge *IgnoredEdge;
+  const BasicBlock *ForkBlock;
+  BlockStateCache *Cache;
+  // Set only with -immutability-elide-scalars
+  const UntrackedScalars *Scalars;
 
   GraphPtr Initial;
   GraphPtr Null;
@@ -34,6 +40,16 @@ private:
   std::deque<const BasicBlock *> Worklist;
   GraphPtr MutableState;
   DenseMap<BasicBlockEdge, GraphPtr> States;
+  DenseMap<BasicBlockEdge, unsigned> StateHashes;
+
+  /* A state computed only from stamped states gets a stamp derived from
+   * theirs, so running a block on the same input stamp again gives nothing
+   * new. Equivalent edge states share a stamp, which lets loops settle.
+   */
+  enum StampKind { SK_MERGE, SK_BLOCK, SK_REFINE };
+  std::map<std::vector<uint64_t>, uint64_t> DerivedStamps;
+  DenseMap<const BasicBlock *, uint64_t> BlockInputStamps;
+  uint64_t deriveStamp(std::vector<uint64_t> Key);
   DenseMap<const Instruction *, GraphPtr> ExitStates;
 
   void addToWorklist(const BasicBlock *BB);
@@ -42,11 +58,15 @@ private:
 
   const GraphPtr &getPredOrNullState(BasicBlockEdge Edge);
   const GraphPtr &getPredOrInitialState(BasicBlockEdge Edge);
+  unsigned getStateHash(BasicBlockEdge Edge);
 
   bool shouldWait(const BasicBlock *BB);
   bool allBottomOrNull(const BasicBlock *BB);
   GraphPtr merge(const BasicBlock *BB);
-  GraphPtr getCurrentState(BasicBlockEdge Edge, const Instruction &I);
+  uint64_t getBottomPreds(const BasicBlock *BB);
+  GraphPtr getCurrentState(BasicBlockEdge Edge, const Instruction &I,
+                           bool IsLastUse);
+  void pruneDeadValues(BasicBlockEdge Edge, Graph &State);
 
   bool isRecursive(const Function *F) const;
   void handleDefaultDeleteCall(const Instruction *I);
@@ -59,7 +79,9 @@ private:
 
   //void computeResult();
 
-  void run();
+  void run(const BasicBlock *Start);
+
+  FunctionAnalysis(const FunctionAnalysis &Prefix, const BasicBlockEdge *E);
   unsigned getDepth() {
       if (ParentAnalysis == nullptr) {
           return 1;
@@ -81,11 +103,13 @@ public:
   FunctionAnalysis(Query *Q,
                    FunctionAnalysis *P,
                    const Function *F,
-                   const GraphPtr &I,
+                   GraphPtr I,
                    const Function *FM,
-                   const BasicBlockEdge *E=nullptr)
+                   const BasicBlockEdge *E=nullptr,
+                   BlockStateCache *C=nullptr)
       : Q(Q), ParentAnalysis(P), CurrentFunction(F), IgnoredEdge(E),
-        FirstMethod(FM) {
+        ForkBlock(nullptr), FirstMethod(FM), Cache(C),
+        Scalars(Q->ElideScalars ? &Q->getUntrackedScalars(F) : nullptr) {
 
     if (ParentAnalysis == nullptr)
       DELETENumCalls = 0;
@@ -105,16 +129,39 @@ public:
     }
       */
     }
-    Initial = I->clone();
-    run();
+    Initial = std::move(I);
+    Initial->setStamp(Graph::createStamp());
+    run(&CurrentFunction->getEntryBlock());
+  }
+
+  /* Runs a top-level method up to, but not including, ForkBB. Every state
+   * before ForkBB is the same whichever of its incoming edges is ignored, so
+   * each ignored edge then only needs getForkResult to run ForkBB itself.
+   */
+  FunctionAnalysis(Query *Q,
+                   const Function *F,
+                   GraphPtr I,
+                   const BasicBlock *ForkBB,
+                   BlockStateCache *C=nullptr)
+      : Q(Q), ParentAnalysis(nullptr), CurrentFunction(F), IgnoredEdge(nullptr),
+        ForkBlock(ForkBB), FirstMethod(F), Cache(C),
+        Scalars(Q->ElideScalars ? &Q->getUntrackedScalars(F) : nullptr) {
+    DELETENumCalls = 1;
+    Initial = std::move(I);
+    Initial->setStamp(Graph::createStamp());
+    run(&CurrentFunction->getEntryBlock());
   }
 
+  // Independent of any other fork, so the edges can run in parallel
+  GraphPtr getForkResult(const BasicBlockEdge &E) const;
+
   // Debug only
   GraphPtr &getExitState(const Instruction *I) {
     assert(ExitStates.count(I) > 0 && "Invalid exit state");
     return ExitStates[I];
   }
 
+  // Consumes the exit states, so only call this once
   GraphPtr getResult();
 
     /*
@@ -36,12 +36,7 @@ inline bool isRelevant(const Function *F, const Value *V) {
     }
   }
   else if (const Argument *A = dyn_cast<Argument>(V)) {
-    for (auto &Arg : F->args()) {
-      if (A == &Arg) {
-        return true;
-      }
-    }
-    return false;
+    return A->getParent() == F;
   }
   else if (isa<Constant>(V)) {
     return false;
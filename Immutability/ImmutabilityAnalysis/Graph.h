@@ -8,6 +8,7 @@
 
 #include "llvm/ADT/GraphTraits.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/InstVisitor.h"
 
 namespace llvm {
@@ -24,6 +25,9 @@ private:
 
   bool IsBottom;
 
+  // Graphs with the same nonzero stamp are equivalent, 0 is unknown
+  uint64_t Stamp = 0;
+
   DenseMap<const Value *, NodePtr> Mapping;
   DenseMap<Node *, const Value *> ReverseMapping;
 
@@ -60,7 +64,16 @@ public:
                                         const StructType *T) {
     GraphPtr G = make_unique<Graph>(Q);
     auto StructArg = cast<StructType>(A->getType()->getPointerElementType());
-    NodePtr N = Node::createThisFromType(T);
+    NodePtr N;
+    if (Q->LazyThis) {
+      N = StructNode::createLazyThis(T);
+    }
+    else if (Q->UsePrototypes) {
+      N = Q->Prototypes.createThis(T);
+    }
+    else {
+      N = Node::createThisFromType(T);
+    }
     if (T != StructArg) {
       auto Indices = Q->C.getSupertypeIndices(T, StructArg);
       NodePtr SubN = N;
@@ -74,6 +87,7 @@ public:
     NodePtr This = PointerNode::createPointee(N);
     This->setIsThis();
     G->addMapping(A, This);
+    G->collapseWideStructs(This);
     return std::move(G);
   }
 
@@ -112,15 +126,29 @@ public:
   }
   void fixupThis(const Argument *A) {
     std::shared_ptr<Node> N = getMapping(A);
-    NodeSetT S;
-    Node::getReachable(S, N);
-    for (const NodePtr &M : S) {
-      M->setIsThis();
-      for (const NodePtr &O : getWeakEdgesShared(M.get())) {
-        Node::addWeakEdge(M, O);
+    uninternReachable(N);
+    {
+      NodeSetT S;
+      Node::getReachable(S, N);
+      for (const NodePtr &M : S) {
+        M->setIsThis();
+        for (const NodePtr &O : getWeakEdgesShared(M.get())) {
+          Node::addWeakEdge(M, O);
+        }
       }
     }
     MemAliases.clear();
+    collapseWideStructs(N);
+    // Fields the method materialized but left alone go back to implicit,
+    // only once the set above no longer holds them
+    auto P = cast<PointerNode>(N.get());
+    if (Q->LazyThis && P->hasPointee()) {
+      if (auto SN = dyn_cast<StructNode>(P->getPointee().get())) {
+        SN->recollapse([this](const Node *M) {
+          return MemAliases.hasAliasKind(M);
+        });
+      }
+    }
   }
   void changeThis(const Argument *NewThis) {
     assert(Mapping.size() == 1);
@@ -205,6 +233,19 @@ public:
   static bool equivalentAllEdges(NodeToNodeSetT &ThisToOther, const Graph &This, const Graph &Other);
   bool equivalent(const Graph &Other, const Function *F) const;
 
+  // Hash.cpp
+  // Graphs that are equivalent for F have the same hash, so unequal hashes
+  // rule out equivalence without the walk
+  unsigned hash(const Function *F) const;
+  static uint64_t createStamp();
+
+  uint64_t getStamp() const {
+    return Stamp;
+  }
+  void setStamp(uint64_t S) {
+    Stamp = S;
+  }
+
   // MoreSpecific.cpp
   bool moreSpecific(NodePtr ThisN, NodePtr OtherN, NodeSetT &Checked,
                   NodeToNodeSetT &ThisToOther, Graph &Other) const;
@@ -247,6 +288,33 @@ public:
   static void mergeRemoveWrongSeqStructCopyEdges(NodeToNodeSetT &SrcToResult);
   static void mergeAddWeakEdges(NodeToNodeSetT &SrcToResult);
 
+  // MergeDistinct.cpp
+  // Drops repeated inputs, then joins the rest pairwise
+  static GraphPtr mergeDistinct(ArrayRef<const Graph *> Inputs);
+
+  // Collect.cpp
+  // Forgets nodes not reachable from the mappings, the return or this
+  void collectGarbage();
+
+  // BlockStateCache.cpp
+  // Roots are the values a block reads from outside of itself
+  bool equivalentOn(const Graph &Other, ArrayRef<const Value *> Roots) const;
+  bool othersReachRoots(ArrayRef<const Value *> Roots,
+                        const BasicBlock *BB) const;
+  GraphPtr graftOthers(const Graph &Input, ArrayRef<const Value *> Roots,
+                       const BasicBlock *BB) const;
+
+  // CollapseFields.cpp
+  // Folds the fields of wide structs no instruction addresses by index into
+  // one summary field per type
+  void collapseWideStructs(const NodePtr &Root);
+
+  // KLimit.cpp
+  // Folds objects of recursive types more than K pointers deep into one
+  // summary per type, joined in with a weak update
+  bool canFoldInto(const NodePtr &N, const NodePtr &Summary);
+  void limitRecursiveDepth(unsigned K);
+
   // TODO: For Debug only
   bool hasMapping(const Value *V) const {
     if (isa<ConstantInt>(V)) {
@@ -263,10 +331,42 @@ public:
     }
     return Mapping.count(V) > 0;
   }
+  // Unlike getMapping, never creates a node
+  NodePtr findMapping(const Value *V) const {
+    return Mapping.lookup(V);
+  }
   void addMapping(const Value *V, NodePtr N) {
     Mapping[V] = N;
     ReverseMapping[N.get()] = V;
   }
+  // For nodes shared by many values, which have no single value to map back
+  void addSharedMapping(const Value *V, NodePtr N) {
+    Mapping[V] = N;
+  }
+  void eraseMapping(const Value *V) {
+    auto It = Mapping.find(V);
+    if (It == Mapping.end()) {
+      return;
+    }
+    auto RIt = ReverseMapping.find(It->second.get());
+    if (RIt != ReverseMapping.end() && RIt->second == V) {
+      ReverseMapping.erase(RIt);
+    }
+    Mapping.erase(It);
+  }
+  template <typename PredT>
+  unsigned eraseMappingsIf(PredT Pred) {
+    SmallVector<const Value *, 16> Dead;
+    for (auto &Entry : Mapping) {
+      if (Pred(Entry.first)) {
+        Dead.push_back(Entry.first);
+      }
+    }
+    for (const Value *V : Dead) {
+      eraseMapping(V);
+    }
+    return Dead.size();
+  }
 
   NodePtr getGEPResult(const GetElementPtrInst &I);
   void addConstantExpr(const ConstantExpr *CE);
@@ -284,6 +384,25 @@ public:
 
   void refineInt(const Value *V, ConstantRange CR);
   void refineBool(const Value *V, bool B);
+  void dropIntRanges() {
+    // Interned constants are shared and keep their single value
+    auto Drop = [](const NodePtr &N) {
+      if (N->isInterned()) {
+        return;
+      }
+      if (auto IN = dyn_cast<IntNode>(N.get())) {
+        IN->setRange(IntRange(IN->getBitWidth(), true));
+      }
+    };
+    for (auto &Entry : Mapping) {
+      const NodePtr &N = Entry.second;
+      Drop(N);
+      // Locals live behind an alloca in debug builds
+      if (N->isPointer() && N->hasPointerPointee()) {
+        Drop(N->getPointerPointee());
+      }
+    }
+  }
 
   void handleDefaultDeleteCall(const Instruction *I);
   void handleUnknownCall(const Instruction *I);
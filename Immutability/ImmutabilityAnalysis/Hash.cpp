@@ -0,0 +1,46 @@
+#include "Graph.h"
+
+#include "FunctionUtil.h"
+
+#include <llvm/ADT/Hashing.h>
+
+#include <atomic>
+
+using namespace llvm;
+using namespace immutability;
+
+namespace {
+
+// Only what Graph::equivalent compares node for node
+hash_code hashShallow(const NodePtr &N) {
+  if (auto IN = dyn_cast<IntNode>(N.get())) {
+    return hash_combine(N->getKind(), IN->getRange().hash());
+  }
+  return hash_combine(N->getKind());
+}
+
+}
+
+unsigned Graph::hash(const Function *F) const {
+  if (IsBottom) {
+    return hash_combine(IsBottom);
+  }
+  // DenseMap order depends on its history, so sum the entries
+  size_t Sum = 0;
+  for (auto &Entry : Mapping) {
+    const Value *V = Entry.first;
+    if (!isa<Instruction>(V) && !isa<Argument>(V)) {
+      continue;
+    }
+    if (!isRelevant(F, V)) {
+      continue;
+    }
+    Sum += hash_combine(V, hashShallow(Entry.second));
+  }
+  return hash_combine(IsBottom, Sum);
+}
+
+uint64_t Graph::createStamp() {
+  static std::atomic<uint64_t> NextStamp(1);
+  return NextStamp++;
+}
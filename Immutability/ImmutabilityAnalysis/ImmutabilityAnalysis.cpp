@@ -4,6 +4,8 @@
 #include "FunctionAnalysis.h"
 //#include "FunctionUtil.h"
 #include "Node.h"
+#include "Reachability.h"
+#include "Traversal.h"
 
 #include <llvm/ADT/APInt.h>
 #include <llvm/ADT/SmallSet.h>
@@ -16,9 +18,12 @@
 #include <llvm/IR/ValueMap.h>
 #include <llvm/IR/InstVisitor.h>
 #include <llvm/Pass.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <algorithm>
 #include <deque>
+#include <functional>
 
 using namespace llvm;
 using namespace immutability;
@@ -26,23 +31,92 @@ using namespace immutability;
 char ImmutabilityAnalysis::ID = 0;
 static RegisterPass<ImmutabilityAnalysis> X("immutability", "Immutability Analysis", false, true);
 
+static cl::opt<bool> UseBlockStateCache(
+    "immutability-block-cache",
+    cl::desc("Reuse block states across runs of the same method"),
+    cl::init(false));
+
+static cl::opt<bool> SimplifyModule(
+    "immutability-simplify",
+    cl::desc("Analyze a copy of the module with stack temporaries promoted"),
+    cl::init(false));
+
+static cl::opt<bool> CollectGarbage(
+    "immutability-gc",
+    cl::desc("Drop unreachable nodes at call returns and block ends"),
+    cl::init(false));
+
+static cl::opt<bool> PruneDeadValues(
+    "immutability-prune-dead",
+    cl::desc("Drop mappings of values that are dead on a block's out edges"),
+    cl::init(false));
+
+static cl::opt<unsigned> RecursiveDepthLimit(
+    "immutability-k-limit",
+    cl::desc("Summarize objects of recursive types deeper than this many "
+             "pointers at block ends (0 disables)"),
+    cl::init(0));
+
+static cl::opt<unsigned> WideStructFields(
+    "immutability-wide-struct",
+    cl::desc("Only track the addressed fields of this structs with at least "
+             "this many fields (0 disables)"),
+    cl::init(0));
+
+static cl::opt<bool> LazyThis(
+    "immutability-lazy-this",
+    cl::desc("Materialize fields of this only when a method reaches them"),
+    cl::init(false));
+
+static cl::opt<bool> UsePrototypes(
+    "immutability-prototypes",
+    cl::desc("Copy this and top nodes from a prototype built once per type"),
+    cl::init(false));
+
+static cl::opt<bool> ElideScalars(
+    "immutability-elide-scalars",
+    cl::desc("Share one node for arithmetic that never reaches a branch, "
+             "memory or a call"),
+    cl::init(false));
+
+static cl::opt<Precision> DefaultPrecision(
+    "immutability-precision",
+    cl::desc("Precision of the analysis for every class"),
+    cl::values(clEnumValN(Precision::Fast, "fast",
+                          "Path-insensitive, no integer ranges"),
+               clEnumValN(Precision::Precise, "precise",
+                          "Full path sensitivity (default)")),
+    cl::init(Precision::Precise));
+
+static cl::list<std::string> PreciseClasses(
+    "immutability-precise-classes",
+    cl::desc("Classes always analyzed with precise precision"),
+    cl::CommaSeparated);
+
 namespace {
 
-void getAllPointees(NodeSetT &S, NodePtr N) {
-  if (N->isPointer()) {
-    if (N->hasPointerPointee()) {
-      auto Pointee = N->getPointerPointee();
-      S.insert(Pointee);
+Precision getPrecision(StringRef ClassName) {
+  for (const std::string &Name : PreciseClasses) {
+    if (ClassName == Name) {
+      return Precision::Precise;
     }
   }
-  else if (N->isStruct()) {
-    for (unsigned I = 0; I < N->getStructNumElements(); ++I) {
-      if (N->hasStructElement(I)) {
-        auto Field = N->getStructElement(I);
-        getAllPointees(S, Field);
+  return DefaultPrecision;
+}
+
+void getAllPointees(NodeSetT &S, NodePtr N) {
+  // Fields of nested structs are part of N, pointers end the walk
+  NodeWalker<> Walker;
+  Walker.addRoot(N.get());
+  Walker.run([&S](Node *M) {
+    if (M->isPointer()) {
+      if (M->hasPointerPointee()) {
+        S.insert(M->getPointerPointee());
       }
+      return false;
     }
-  }
+    return M->isStruct();
+  });
 }
 
 std::vector<BasicBlockEdge> getIgnoredEdges(const Function *F) {
@@ -130,8 +204,28 @@ bool ImmutabilityAnalysis::runOnModule(Module &M) {
     assert(!Err);
 
     errs() << ":: I'm here!!! ImmutabilityAnalysis::runOnModule!\n";
-    Q = make_unique<Query>(getAnalysis<ClassQuery>(),
-                           getAnalysis<MemQuery>());
+    Module *Analyzed = &M;
+    if (SimplifyModule) {
+      Simplified = make_unique<SimplifiedModule>(M);
+      Analyzed = &Simplified->getModule();
+      Q = make_unique<Query>(Simplified->getClassQuery(),
+                             Simplified->getMemQuery());
+    }
+    else {
+      Q = make_unique<Query>(getAnalysis<ClassQuery>(),
+                             getAnalysis<MemQuery>());
+    }
+    Q->CollectGarbage = CollectGarbage;
+    Q->PruneDeadValues = PruneDeadValues;
+    Q->RecursiveDepthLimit = RecursiveDepthLimit;
+    Q->LazyThis = LazyThis;
+    Q->UsePrototypes = UsePrototypes;
+    Q->ElideScalars = ElideScalars;
+    if (WideStructFields > 0) {
+      Accessed = make_unique<AccessedFields>(*Analyzed);
+      Q->Accessed = Accessed.get();
+      Q->WideStructFields = WideStructFields;
+    }
 
     database::setup();
     unsigned NumClasses = 0;
@@ -143,6 +237,9 @@ bool ImmutabilityAnalysis::runOnModule(Module &M) {
       bool HasUnknownMethod = false;
       for (database::MethodEntry &ME : Entry.Methods) {
         const Function *F = M.getFunction(ME.MangledName);
+        if (F && Simplified) {
+          F = Simplified->getSimplified(F);
+        }
         /* if (ME.MangledName != "_ZNK8Sequence7PolySNP7ThetaPiEv") continue; // TODO: DELETE */
         /* if (ME.MangledName != "_ZNK8Sequence7PolySNP15StochasticVarPiEv") continue; // TODO: DELETE */
         /* if (ME.MangledName != "_ZNK8Sequence7PolySNP9FuLiDStarEv" */
@@ -327,7 +424,7 @@ if(Entry.Name != "BytesValue") continue;
           if (T != StructTy) {
             SmallPtrSet<const StructType *, 16> SubStructs;
 
-            addSubStructs(M, SubStructs, StructTy);
+            addSubStructs(*Analyzed, SubStructs, StructTy);
             if (SubStructs.count(T)) {
               T = StructTy;
             }
@@ -348,6 +445,8 @@ if(Entry.Name != "BytesValue") continue;
       CurrentType = T;
       IncompleteMethodInitialStates.clear();
       CompleteMethodInitialStates.clear();
+      BlockStateCaches.clear();
+      Q->Mode = getPrecision(Entry.Name);
 
       analyzeMethods(Entry.Name, PublicConstMethods);
       ++NumClasses;
@@ -431,6 +530,21 @@ if(Entry.Name != "BytesValue") continue;
     */
 }
 
+BlockStateCache *ImmutabilityAnalysis::getBlockStateCache(
+    const Function *Method) {
+  if (!UseBlockStateCache) {
+    return nullptr;
+  }
+  Mutex.lock();
+  auto &Cache = BlockStateCaches[Method];
+  if (!Cache) {
+    Cache = make_unique<BlockStateCache>(Method);
+  }
+  BlockStateCache *Ret = Cache.get();
+  Mutex.unlock();
+  return Ret;
+}
+
 bool ImmutabilityAnalysis::hasEquivalentInitialState(
     GraphPtr &State, std::vector<GraphPtr> &InitialStates) {
   for (auto &InitialState : InitialStates) {
@@ -447,9 +561,13 @@ void ImmutabilityAnalysis::handleFinalState(const FunctionSet &Methods,
   Mutex.lock();
   assert(FinalState);
 
+  // The last method takes the final state itself instead of a clone
+  unsigned Remaining = Methods.size();
   for (auto Method : Methods) {
     const Argument *ThisArg = getThisArg(Method);;
-    GraphPtr NextState = FinalState->clone();
+    --Remaining;
+    GraphPtr NextState = Remaining == 0 ? std::move(FinalState)
+                                        : FinalState->clone();
     NextState->changeThis(ThisArg);
 
     if (hasEquivalentInitialState(NextState,
@@ -552,121 +670,127 @@ public:
   }
 };
 
-void ImmutabilityAnalysis::checkArgument(const Function *Method, const GraphPtr &ResultState, const Argument *Arg) {
-      // Non-this argument
-      NodePtr N = ResultState->getMapping(Arg);
+void ImmutabilityAnalysis::checkEscapes(const Function *Method, const GraphPtr &ResultState) {
+  const Argument *ThisArg = getThisArg(Method);
 
-      NodeSetT Pointees;
-      getAllPointees(Pointees, N);
-      for (auto Pointee : Pointees) {
-        Pointee->setIsRead();
-        for (auto &TN : Pointee->getThisEdges()) {
-          TN->setIsRead();
-        }
-        auto S = Node::getReachable(Pointee);
-        for (auto R : S) {
-          if (R->isThis()) {
-            database::addIssue(Method->getName(), "ESCAPEARG");
-            // errs() << "    \033[1;31mESCAPEARG @ "
-            //        << Method->getName() << "\033[0m\n";
-            break;
-          }
-          for (auto ThisN : R->getThisEdges()) {
-            database::addIssue(Method->getName(), "ESCAPEARG");
-            //errs() << "    \033[1;31mESCAPEARG @ "
-            //       << Method->getName() << "\033[0m\n";
-            break;
-          }
-          R->setIsRead();
-          for (auto &TN : R->getThisEdges()) {
-            TN->setIsRead();
-          }
-        }
-      }
-      /*
-      auto S = Node::getReachable(N);
-      for (auto N : S) {
-        if (N->isSeq()) {
-          if (N->isThis()) {
-            errs() << "    \033[1;31mESCAPEARG @ "
-                    << Method->getName() << "\033[0m\n";
-            break;
-          }
-          for (auto ThisN : N->getThisEdges()) {
-            errs() << "    \033[1;31mESCAPEARG @ "
-                   << Method->getName() << "\033[0m\n";
-            break;
-          }
-        }
-        N->setIsRead();
-        for (auto &TN : N->getThisEdges()) {
-          TN->setIsRead();
-        }
-      }
-      */
-}
+  // Non-this arguments escape this through what they point to
+  NodeSetT Pointees;
+  for (const Argument &A : Method->args()) {
+    if (ThisArg == &A) {
+      continue;
+    }
+    getAllPointees(Pointees, ResultState->getMapping(&A));
+  }
+  std::vector<Node *> ArgSources;
+  for (const NodePtr &Pointee : Pointees) {
+    ArgSources.push_back(Pointee.get());
+  }
+  std::vector<Node *> Roots = ArgSources;
+  NodePtr Return;
+  if (ResultState->hasReturn()) {
+    Return = ResultState->getReturn();
+    Roots.push_back(Return.get());
+  }
 
-void ImmutabilityAnalysis::checkReturn(const Function *Method, const GraphPtr &ResultState) {
-      auto Return = ResultState->getReturn();
-      /*
-      Return->setIsRead();
-      for (auto &TN : Return->getThisEdges()) {
-        TN->setIsRead();
-      }
-      */
-      auto S = Node::getReachable(ResultState->getReturn());
-      for (auto N : S) {
-        N->setIsRead();
-        for (auto &TN : N->getThisEdges()) {
-          TN->setIsRead();
-        }
+  ReachabilityIndex Index(Roots);
+  BitVector Read = Index.getReachable(ArgSources);
+  if (Index.reachesThis(Read)) {
+    database::addIssue(Method->getName(), "ESCAPEARG");
+  }
+  BitVector FromReturn;
+  if (Return) {
+    FromReturn = Index.getReachable(Return.get());
+    if (Return->isPointer() && Index.reachesThis(FromReturn)) {
+      std::string Description;
+      llvm::raw_string_ostream DescriptionOS(Description);
+      DescriptionOS << "ESCAPERET @ " << Method->getName();
+      database::addIssue(Method->getName(), DescriptionOS.str());
+    }
+  }
+
+#ifndef NDEBUG
+  // The index has to reach exactly what Node::getReachable reaches, or
+  // escapes get missed or made up
+  {
+    NodeSetT FromPointees;
+    for (const NodePtr &Pointee : Pointees) {
+      Node::getReachable(FromPointees, Pointee);
+    }
+    for (const NodePtr &R : FromPointees) {
+      assert(Index.isReachable(Read, R.get()) && "Edge sets differ");
+    }
+    assert(Read.count() == FromPointees.size() && "Edge sets differ");
+    if (Return) {
+      NodeSetT FromRet = Node::getReachable(Return);
+      for (const NodePtr &R : FromRet) {
+        assert(Index.isReachable(FromReturn, R.get()) && "Edge sets differ");
       }
-      if (ResultState->getReturn()->isPointer()) {
-        for (auto N : S) {
-          if (N->isThis()) {
-            std::string Description;
-            llvm::raw_string_ostream DescriptionOS(Description);
-            DescriptionOS << "ESCAPERET @ " << Method->getName();
-            if (Method) {
-              database::addIssue(Method->getName(), DescriptionOS.str());
-            }
-          }
-          for (auto ThisN : N->getThisEdges()) {
-            std::string Description;
-            llvm::raw_string_ostream DescriptionOS(Description);
-            DescriptionOS << "ESCAPERET @ " << Method->getName();
-            if (Method) {
-              database::addIssue(Method->getName(), DescriptionOS.str());
-            }
-          }
-        }
+      assert(FromReturn.count() == FromRet.size() && "Edge sets differ");
+    }
+  }
+#endif
+
+  auto MarkRead = [](Node *N) {
+    N->setIsRead();
+    for (auto &TN : N->getThisEdges()) {
+      TN->setIsRead();
+    }
+  };
+  // What an argument points to is read up to the first this node, in the
+  // order of the reachable set
+  for (Node *Pointee : ArgSources) {
+    MarkRead(Pointee);
+    std::vector<Node *> Reachable;
+    for (unsigned I : Index.getReachable(Pointee).set_bits()) {
+      Reachable.push_back(Index.getNode(I));
+    }
+    std::sort(Reachable.begin(), Reachable.end(), std::less<Node *>());
+    for (Node *R : Reachable) {
+      if (R->isThis()) {
+        break;
       }
+      MarkRead(R);
+    }
+  }
+  if (Return) {
+    for (unsigned I : FromReturn.set_bits()) {
+      MarkRead(Index.getNode(I));
+    }
+  }
 }
 
-void ImmutabilityAnalysis::runMethod(const GraphPtr &InitialState, std::string &ClassName, const FunctionSet &Methods, const Function *Method, const BasicBlockEdge *IgnoredEdge) {
+void ImmutabilityAnalysis::runMethod(GraphPtr InitialState, std::string &ClassName, const FunctionSet &Methods, const Function *Method) {
   errs() << "  \033[1;36m" << IterationNum << "\033[0;36m "
          << Method->getName() << "\033[m\n";
-  const Argument *ThisArg = getThisArg(Method);
   assert(InitialState);
-  FunctionAnalysis FA(Q.get(), nullptr, Method, InitialState, Method, IgnoredEdge);
-  auto ResultState = FA.getResult();
+  FunctionAnalysis FA(Q.get(), nullptr, Method, std::move(InitialState),
+                      Method, nullptr,
+                      getBlockStateCache(Method));
+  handleResult(ClassName, Methods, Method, FA.getResult());
+}
+
+void ImmutabilityAnalysis::runMethodForked(GraphPtr InitialState, std::string &ClassName, const FunctionSet &Methods, const Function *Method, ArrayRef<BasicBlockEdge> IgnoredEdges) {
+  assert(InitialState);
+  // All the ignored edges end in the single exit block
+  FunctionAnalysis Prefix(Q.get(), Method, std::move(InitialState),
+                          IgnoredEdges.front().getEnd(),
+                          getBlockStateCache(Method));
+  for (const BasicBlockEdge &IgnoredEdge : IgnoredEdges) {
+    errs() << "  \033[1;36m" << IterationNum << "\033[0;36m "
+           << Method->getName() << "\033[m\n";
+    handleResult(ClassName, Methods, Method, Prefix.getForkResult(IgnoredEdge));
+  }
+}
+
+void ImmutabilityAnalysis::handleResult(std::string &ClassName, const FunctionSet &Methods, const Function *Method, GraphPtr ResultState) {
+  const Argument *ThisArg = getThisArg(Method);
   ResultState->dot(ClassName, IterationNum, Method->getName());
   if (!ResultState->isBottom()) {
-    for (const Argument &A : Method->args()) {
-      if (ThisArg == &A) {
-        continue;
-      }
-      // Non-this argument
-      checkArgument(Method, ResultState, &A);
-    }
-    if (ResultState->hasReturn()) {
-      checkReturn(Method, ResultState);
-    }
+    checkEscapes(Method, ResultState);
     ResultState->removeAllExcept(ThisArg);
     ResultState->fixupThis(ThisArg);
     assert(ResultState->getMapping(ThisArg)->isThis());
-    GraphPtr FinalState = ResultState->clone();
-    handleFinalState(Methods, std::move(FinalState));
+    handleFinalState(Methods, std::move(ResultState));
   }
   ++IterationNum;
 }
@@ -700,7 +824,10 @@ void ImmutabilityAnalysis::iteration(std::string &ClassName, const FunctionSet &
 
     // const Argument *ThisArg = getThisArg(Method);
 
-  std::vector<BasicBlockEdge> IgnoredEdges = getIgnoredEdges(Method);
+  std::vector<BasicBlockEdge> IgnoredEdges;
+  if (Q->splitsIgnoredEdges()) {
+    IgnoredEdges = getIgnoredEdges(Method);
+  }
 
 #if DEBUG_IMMUTABILITY_ANALYSIS
   dbgs() << "METHOD: Push complete initial state to "
@@ -712,12 +839,11 @@ void ImmutabilityAnalysis::iteration(std::string &ClassName, const FunctionSet &
   Mutex.unlock();
 
   if (IgnoredEdges.empty()) {
-    runMethod(InitialState, ClassName, Methods, Method);
+    runMethod(std::move(InitialState), ClassName, Methods, Method);
   }
   else {
-    for (const BasicBlockEdge &IgnoredEdge : IgnoredEdges) {
-      runMethod(InitialState, ClassName, Methods, Method, &IgnoredEdge);
-    }
+    runMethodForked(std::move(InitialState), ClassName, Methods, Method,
+                    IgnoredEdges);
   }
 }
 
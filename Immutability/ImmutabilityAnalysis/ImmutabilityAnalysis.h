@@ -1,10 +1,12 @@
 #ifndef LLVM_ANALYSIS_IMMUTABILITY
 #define LLVM_ANALYSIS_IMMUTABILITY
 
+#include "BlockStateCache.h"
 #include "Database.h"
 #include "Query.h"
 #include "FunctionUtil.h"
 #include "Graph.h"
+#include "SimplifiedModule.h"
 
 #include <llvm/IR/Dominators.h>
 #include <llvm/IR/Instructions.h>
@@ -62,6 +64,8 @@ public:
   unsigned IterationNum;
 
   std::unique_ptr<Query> Q;
+  std::unique_ptr<SimplifiedModule> Simplified;
+  std::unique_ptr<AccessedFields> Accessed;
 
   const StructType *CurrentType;
 
@@ -70,6 +74,8 @@ public:
   MethodStates IncompleteMethodInitialStates;
   MethodStates CompleteMethodInitialStates;
 
+  DenseMap<const Function *, std::unique_ptr<BlockStateCache>> BlockStateCaches;
+
   ImmutabilityAnalysis() : ModulePass(ID) {
     Futures.resize(16);
     errs() << ":: ImmutabilityAnalysis - Constructor\n";
@@ -389,15 +395,18 @@ public:
   }
 private:
 
+  BlockStateCache *getBlockStateCache(const Function *Method);
+
   bool hasEquivalentInitialState(GraphPtr &State,
                                  std::vector<GraphPtr> &InitialStates);
   void handleFinalState(const FunctionSet &Methods,
                         GraphPtr FinalState);
   void analyzeMethods(std::string &ClassName, const FunctionSet &Methods);
 
-  void runMethod(const GraphPtr &InitialState, std::string &ClassName, const FunctionSet &Methods, const Function *Method, const BasicBlockEdge *IgnoredEdge=nullptr);
-  void checkArgument(const Function *Method, const GraphPtr &ResultState, const Argument *Arg);
-  void checkReturn(const Function *Method, const GraphPtr &ResultState);
+  void runMethod(GraphPtr InitialState, std::string &ClassName, const FunctionSet &Methods, const Function *Method);
+  void runMethodForked(GraphPtr InitialState, std::string &ClassName, const FunctionSet &Methods, const Function *Method, ArrayRef<BasicBlockEdge> IgnoredEdges);
+  void handleResult(std::string &ClassName, const FunctionSet &Methods, const Function *Method, GraphPtr ResultState);
+  void checkEscapes(const Function *Method, const GraphPtr &ResultState);
 };
 
 }
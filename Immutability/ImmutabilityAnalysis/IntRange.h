@@ -0,0 +1,248 @@
+#ifndef LLVM_ANALYSIS_IMMUTABILITY_INT_RANGE_H
+#define LLVM_ANALYSIS_IMMUTABILITY_INT_RANGE_H
+
+#include <llvm/ADT/Hashing.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/IR/ConstantRange.h>
+
+#include <cstdint>
+#include <memory>
+
+namespace llvm {
+namespace immutability {
+
+/* A ConstantRange kept in two plain words for widths up to 64 bits, which
+ * is almost every integer in the programs we look at. The bounds mean the
+ * same as in ConstantRange: [Lower, Upper) modulo 2^BitWidth, full when both
+ * are the maximum value and empty when both are 0.
+ *
+ * Join, meet and containment follow ConstantRange exactly on unwrapped
+ * ranges, anything else goes through ConstantRange. Wider types always do,
+ * and keep their ConstantRange out of line so the common case stays small.
+ */
+class IntRange {
+  unsigned BitWidth;
+  uint64_t Lower;
+  uint64_t Upper;
+  std::unique_ptr<ConstantRange> Wide;
+
+  IntRange(unsigned BitWidth, uint64_t Lower, uint64_t Upper)
+      : BitWidth(BitWidth), Lower(Lower), Upper(Upper) {}
+
+  uint64_t getMask() const {
+    return BitWidth == 64 ? ~UINT64_C(0) : (UINT64_C(1) << BitWidth) - 1;
+  }
+  bool isSmall() const {
+    return !Wide;
+  }
+  bool isWrappedSet() const {
+    return Lower > Upper;
+  }
+  IntRange full() const {
+    return IntRange(BitWidth, true);
+  }
+  IntRange empty() const {
+    return IntRange(BitWidth, false);
+  }
+
+public:
+  IntRange(unsigned BitWidth, bool Full) : BitWidth(BitWidth) {
+    if (BitWidth > 64) {
+      Wide.reset(new ConstantRange(BitWidth, Full));
+      Lower = Upper = 0;
+    }
+    else {
+      Lower = Upper = Full ? getMask() : 0;
+    }
+  }
+  explicit IntRange(const APInt &V) : BitWidth(V.getBitWidth()) {
+    if (BitWidth > 64) {
+      Wide.reset(new ConstantRange(V));
+      Lower = Upper = 0;
+    }
+    else {
+      Lower = V.getZExtValue();
+      Upper = (Lower + 1) & getMask();
+    }
+  }
+  explicit IntRange(const ConstantRange &CR) : BitWidth(CR.getBitWidth()) {
+    if (BitWidth > 64) {
+      Wide.reset(new ConstantRange(CR));
+      Lower = Upper = 0;
+    }
+    else {
+      Lower = CR.getLower().getZExtValue();
+      Upper = CR.getUpper().getZExtValue();
+    }
+  }
+  IntRange(const IntRange &Other)
+      : BitWidth(Other.BitWidth), Lower(Other.Lower), Upper(Other.Upper) {
+    if (Other.Wide) {
+      Wide.reset(new ConstantRange(*Other.Wide));
+    }
+  }
+  IntRange(IntRange &&Other) = default;
+  IntRange &operator=(const IntRange &Other) {
+    if (this != &Other) {
+      BitWidth = Other.BitWidth;
+      Lower = Other.Lower;
+      Upper = Other.Upper;
+      Wide.reset(Other.Wide ? new ConstantRange(*Other.Wide) : nullptr);
+    }
+    return *this;
+  }
+  IntRange &operator=(IntRange &&Other) = default;
+
+  ConstantRange toConstantRange() const {
+    if (!isSmall()) {
+      return *Wide;
+    }
+    if (Lower == Upper) {
+      return ConstantRange(BitWidth, Lower != 0);
+    }
+    return ConstantRange(APInt(BitWidth, Lower), APInt(BitWidth, Upper));
+  }
+
+  unsigned getBitWidth() const {
+    return BitWidth;
+  }
+  bool isFullSet() const {
+    if (!isSmall()) {
+      return Wide->isFullSet();
+    }
+    return Lower == Upper && Lower != 0;
+  }
+  bool isEmptySet() const {
+    if (!isSmall()) {
+      return Wide->isEmptySet();
+    }
+    return Lower == Upper && Lower == 0;
+  }
+  bool isSingleElement() const {
+    if (!isSmall()) {
+      return Wide->isSingleElement();
+    }
+    return ((Upper - Lower) & getMask()) == 1;
+  }
+  // Single element ranges only, like ConstantRange::getSingleElement
+  bool isTrue() const {
+    if (!isSmall()) {
+      return Wide->isSingleElement() && Wide->getLower().getBoolValue();
+    }
+    return isSingleElement() && Lower != 0;
+  }
+  bool isFalse() const {
+    if (!isSmall()) {
+      return Wide->isSingleElement() && !Wide->getLower().getBoolValue();
+    }
+    return isSingleElement() && Lower == 0;
+  }
+
+  bool contains(const IntRange &Other) const {
+    if (!isSmall()) {
+      return Wide->contains(Other.toConstantRange());
+    }
+    if (isFullSet() || Other.isEmptySet()) {
+      return true;
+    }
+    if (isEmptySet() || Other.isFullSet()) {
+      return false;
+    }
+    if (!isWrappedSet()) {
+      if (Other.isWrappedSet()) {
+        return false;
+      }
+      return Lower <= Other.Lower && Other.Upper <= Upper;
+    }
+    if (!Other.isWrappedSet()) {
+      return Other.Upper <= Upper || Lower <= Other.Lower;
+    }
+    return Other.Upper <= Upper && Lower <= Other.Lower;
+  }
+
+  IntRange unionWith(const IntRange &Other) const {
+    assert(BitWidth == Other.BitWidth && "Integer bitwidths need to match");
+    if (!isSmall() || isWrappedSet() || Other.isWrappedSet()) {
+      return IntRange(toConstantRange().unionWith(Other.toConstantRange()));
+    }
+    if (isEmptySet()) {
+      return Other;
+    }
+    if (Other.isEmptySet()) {
+      return *this;
+    }
+    if (isFullSet() || Other.isFullSet()) {
+      return full();
+    }
+    uint64_t Mask = getMask();
+    if (Other.Upper < Lower || Upper < Other.Lower) {
+      // Disjoint, bridge the smaller gap
+      uint64_t D1 = (Other.Lower - Upper) & Mask;
+      uint64_t D2 = (Lower - Other.Upper) & Mask;
+      if (D1 < D2) {
+        return IntRange(BitWidth, Lower, Other.Upper);
+      }
+      return IntRange(BitWidth, Other.Lower, Upper);
+    }
+    uint64_t L = Other.Lower < Lower ? Other.Lower : Lower;
+    uint64_t U = ((Other.Upper - 1) & Mask) > ((Upper - 1) & Mask)
+                 ? Other.Upper : Upper;
+    if (L == 0 && U == 0) {
+      return full();
+    }
+    return IntRange(BitWidth, L, U);
+  }
+
+  IntRange intersectWith(const IntRange &Other) const {
+    assert(BitWidth == Other.BitWidth && "Integer bitwidths need to match");
+    if (!isSmall() || isWrappedSet() || Other.isWrappedSet()) {
+      return IntRange(toConstantRange().intersectWith(
+          Other.toConstantRange()));
+    }
+    if (isEmptySet() || Other.isFullSet()) {
+      return *this;
+    }
+    if (Other.isEmptySet() || isFullSet()) {
+      return Other;
+    }
+    if (Lower < Other.Lower) {
+      if (Upper <= Other.Lower) {
+        return empty();
+      }
+      if (Upper < Other.Upper) {
+        return IntRange(BitWidth, Other.Lower, Upper);
+      }
+      return Other;
+    }
+    if (Upper < Other.Upper) {
+      return *this;
+    }
+    if (Lower < Other.Upper) {
+      return IntRange(BitWidth, Lower, Other.Upper);
+    }
+    return empty();
+  }
+
+  bool operator==(const IntRange &Other) const {
+    if (!isSmall() || !Other.isSmall()) {
+      return toConstantRange() == Other.toConstantRange();
+    }
+    return BitWidth == Other.BitWidth && Lower == Other.Lower
+           && Upper == Other.Upper;
+  }
+  bool operator!=(const IntRange &Other) const {
+    return !(*this == Other);
+  }
+
+  hash_code hash() const {
+    if (!isSmall()) {
+      return hash_combine(BitWidth, Wide->getLower(), Wide->getUpper());
+    }
+    return hash_combine(BitWidth, Lower, Upper);
+  }
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,61 @@
+/* Checks IntRange against ConstantRange on every pair of 4-bit ranges: the
+ * round trip, the predicates, unionWith, intersectWith and contains have to
+ * give exactly what ConstantRange gives. Built and run by ctest.
+ */
+#include "IntRange.h"
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <vector>
+
+using namespace llvm;
+using namespace immutability;
+
+int main() {
+  const unsigned BitWidth = 4;
+  const unsigned NumValues = 1U << BitWidth;
+
+  std::vector<ConstantRange> All;
+  All.push_back(ConstantRange(BitWidth, true));
+  All.push_back(ConstantRange(BitWidth, false));
+  for (unsigned L = 0; L < NumValues; ++L) {
+    for (unsigned U = 0; U < NumValues; ++U) {
+      if (L != U) {
+        All.push_back(ConstantRange(APInt(BitWidth, L), APInt(BitWidth, U)));
+      }
+    }
+  }
+
+  unsigned NumFailed = 0;
+  auto Fail = [&NumFailed](const char *What, const ConstantRange &A,
+                           const ConstantRange &B) {
+    errs() << What << " differs for " << A << " and " << B << '\n';
+    ++NumFailed;
+  };
+  for (const ConstantRange &A : All) {
+    IntRange RA(A);
+    if (RA.toConstantRange() != A) {
+      Fail("toConstantRange", A, A);
+    }
+    if (RA.isFullSet() != A.isFullSet() || RA.isEmptySet() != A.isEmptySet()
+        || RA.isSingleElement() != A.isSingleElement()) {
+      Fail("A predicate", A, A);
+    }
+    for (const ConstantRange &B : All) {
+      IntRange RB(B);
+      if (RA.unionWith(RB).toConstantRange() != A.unionWith(B)) {
+        Fail("unionWith", A, B);
+      }
+      if (RA.intersectWith(RB).toConstantRange() != A.intersectWith(B)) {
+        Fail("intersectWith", A, B);
+      }
+      if (RA.contains(RB) != A.contains(B)) {
+        Fail("contains", A, B);
+      }
+    }
+  }
+
+  outs() << All.size() * All.size() << " pairs, " << NumFailed
+         << " failed\n";
+  return NumFailed != 0;
+}
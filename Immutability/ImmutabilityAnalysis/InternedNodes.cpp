@@ -0,0 +1,101 @@
+#include "Node.h"
+
+#include "Traversal.h"
+
+#include <llvm/ADT/Statistic.h>
+
+#include <atomic>
+
+#define DEBUG_TYPE "immutability"
+
+using namespace llvm;
+using namespace immutability;
+
+STATISTIC(NumInternedConstants, "Number of interned constant nodes");
+STATISTIC(NumUntrackedScalars, "Number of untracked scalar type nodes");
+
+namespace {
+
+std::atomic<bool> InternConstants(false);
+
+/* ConstantInts are unique per context, so the pointer identifies the value.
+ * Each thread has its own table, so the methods analyzed at the same time on
+ * different threads never mark the same node. The tables are never freed, a
+ * node may outlive its thread in a result handed to another one.
+ */
+typedef DenseMap<const ConstantInt *, IntNodePtr> ConstantTableT;
+thread_local ConstantTableT *Constants = nullptr;
+
+typedef DenseMap<const Type *, NodePtr> ScalarTableT;
+thread_local ScalarTableT *Scalars = nullptr;
+
+}
+
+bool llvm::immutability::internsConstants() {
+  return InternConstants.load(std::memory_order_relaxed);
+}
+
+void llvm::immutability::setInternsConstants(bool B) {
+  InternConstants.store(B, std::memory_order_relaxed);
+}
+
+IntNodePtr IntNode::createInterned(const ConstantInt *CI) {
+  if (!Constants) {
+    Constants = new ConstantTableT();
+  }
+  IntNodePtr &N = (*Constants)[CI];
+  if (!N) {
+    ++NumInternedConstants;
+    N = makeNode<IntNode>(CI->getType());
+    N->Range = IntRange(CI->getValue());
+    N->IsInterned = true;
+  }
+  return N;
+}
+
+NodePtr Node::getUntrackedScalar(const Type *T) {
+  if (!Scalars) {
+    Scalars = new ScalarTableT();
+  }
+  NodePtr &N = (*Scalars)[T];
+  if (!N) {
+    ++NumUntrackedScalars;
+    if (auto IT = dyn_cast<IntegerType>(T)) {
+      N = IntNode::createUninitialized(IT);
+    }
+    else {
+      assert(T->isFloatingPointTy());
+      N = makeNode<FloatingPointNode>(T);
+    }
+    N->IsInterned = true;
+  }
+  return N;
+}
+
+void llvm::immutability::uninternReachable(const NodePtr &Root) {
+  NodeWalker<> Walker;
+  Walker.addRoot(Root.get());
+  Walker.run([](Node *N) {
+    if (auto P = dyn_cast<PointerNode>(N)) {
+      if (P->hasPointee() && P->getPointee()->isInterned()) {
+        P->setPointee(P->getPointee()->copy());
+      }
+    }
+    else if (auto SN = dyn_cast<StructNode>(N)) {
+      for (unsigned I = 0; I < SN->getNumFields(); ++I) {
+        if (SN->hasElement(I) && SN->getElement(I)->isInterned()) {
+          SN->setField(I, SN->getElement(I)->copy());
+        }
+      }
+    }
+    else if (auto SN = dyn_cast<SequentialNode>(N)) {
+      for (unsigned I = 0; I < SN->getNumSlots(); ++I) {
+        NodePtr E = SN->getSlotElement(I);
+        if (E && E->isInterned()) {
+          SN->setElement(I, E->copy());
+        }
+      }
+    }
+    return true;
+  });
+}
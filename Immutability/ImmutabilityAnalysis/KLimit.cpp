@@ -0,0 +1,220 @@
+#include "Graph.h"
+
+#include "TypeUtil.h"
+
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/Statistic.h>
+
+#include <deque>
+
+#define DEBUG_TYPE "immutability"
+
+using namespace llvm;
+using namespace immutability;
+
+STATISTIC(NumSummaryNodes, "Number of summary nodes for recursive types");
+STATISTIC(NumFoldedNodes, "Number of nodes folded into a summary node");
+
+namespace {
+
+class DepthLimiter {
+  unsigned K;
+  uint64_t Epoch;
+  DenseMap<const StructType *, bool> Recursive;
+  DenseMap<const Type *, NodePtr> Summaries;
+  std::deque<std::pair<Node *, unsigned>> Queue;
+
+public:
+  // Every pointer reaching each node, and the nodes held inside composites
+  DenseMap<Node *, SmallVector<PointerNode *, 2>> Referrers;
+  SmallPtrSet<Node *, 16> Embedded;
+  // Objects past depth K and the summary of their type, each once, in
+  // visit order
+  std::vector<std::pair<NodePtr, NodePtr>> Candidates;
+
+private:
+  bool isRecursive(const Node *N) {
+    auto ST = dyn_cast<StructType>(N->getType());
+    if (!ST) {
+      return false;
+    }
+    auto It = Recursive.find(ST);
+    if (It != Recursive.end()) {
+      return It->second;
+    }
+    bool R = isRecursiveTy(ST);
+    Recursive[ST] = R;
+    return R;
+  }
+
+  void push(Node *N, unsigned Depth) {
+    if (N->markVisited(Epoch)) {
+      Queue.emplace_back(N, Depth);
+    }
+  }
+
+  void visitPointer(PointerNode *P, unsigned Depth) {
+    if (!P->hasPointee()) {
+      return;
+    }
+    NodePtr Pointee = P->getPointee();
+    auto &Refs = Referrers[Pointee.get()];
+    Refs.push_back(P);
+    // The first pointer found is at the shallowest depth, the node is
+    // already queued and classified
+    if (Refs.size() > 1) {
+      return;
+    }
+    if (!isRecursive(Pointee.get())) {
+      push(Pointee.get(), Depth);
+      return;
+    }
+    if (Depth >= K && !Pointee->isSummary()) {
+      NodePtr &Summary = Summaries[Pointee->getType()];
+      if (!Summary) {
+        Summary = Pointee;
+      }
+      else if (Summary != Pointee) {
+        Candidates.emplace_back(Pointee, Summary);
+      }
+    }
+    push(Pointee.get(), Depth + 1);
+  }
+
+public:
+  explicit DepthLimiter(unsigned K) : K(K), Epoch(Node::createVisitEpoch()) {}
+
+  void addRoot(Node *N) {
+    push(N, 0);
+  }
+
+  // Breadth first, so each node is seen at its shallowest depth
+  void run() {
+    while (!Queue.empty()) {
+      Node *N = Queue.front().first;
+      unsigned Depth = Queue.front().second;
+      Queue.pop_front();
+      if (auto P = dyn_cast<PointerNode>(N)) {
+        visitPointer(P, Depth);
+      }
+      else if (N->isComposite()) {
+        for (unsigned I = 0; I < N->getNumElementSlots(); ++I) {
+          if (N->hasMaterializedElement(I)) {
+            Node *E = N->getCompositeElement(I).get();
+            Embedded.insert(E);
+            push(E, Depth);
+          }
+        }
+      }
+    }
+  }
+};
+
+typedef DenseSet<std::pair<const Node *, const Node *>> JoinedT;
+
+// Weak update of Summary with everything N holds, pointees N and Summary
+// disagree on are joined as well and stay weakly linked
+void joinInto(const NodePtr &Summary, const NodePtr &N, JoinedT &Joined) {
+  if (Summary == N || !Joined.insert({Summary.get(), N.get()}).second) {
+    return;
+  }
+  if (Summary->getType() != N->getType() || Summary->isInterned()) {
+    if (!Summary->isInterned() && !N->isInterned()) {
+      Node::addWeakEdge(Summary, N);
+    }
+    return;
+  }
+  Summary->Node::unionWith(*N);
+  if (N->isSummary()) {
+    Summary->markIsSummary();
+  }
+  // The summary is no exact copy of anything, copies of N only alias it
+  for (const NodePtr &C : N->getCopyNodes()) {
+    if (C != Summary && !C->isInterned()) {
+      Node::addWeakEdge(Summary, C);
+    }
+  }
+  for (const NodePtr &W : N->getWeakNodes()) {
+    if (W != Summary && !W->isInterned()) {
+      Node::addWeakEdge(Summary, W);
+    }
+  }
+  if (auto SI = dyn_cast<IntNode>(Summary.get())) {
+    SI->unionWith(*cast<IntNode>(N.get()));
+  }
+  else if (auto SP = dyn_cast<PointerNode>(Summary.get())) {
+    auto NP = cast<PointerNode>(N.get());
+    SP->setNullKind(PointerNode::join(SP->getNullKind(), NP->getNullKind()));
+    if (!NP->hasPointee()) {
+      return;
+    }
+    if (!SP->hasPointee()) {
+      SP->setPointee(NP->getPointee());
+    }
+    else if (SP->getPointee() != NP->getPointee()) {
+      joinInto(SP->getPointee(), NP->getPointee(), Joined);
+      if (!NP->getPointee()->isInterned()) {
+        Node::addWeakEdge(SP->getPointee(), NP->getPointee());
+      }
+    }
+  }
+  else if (Summary->isComposite()) {
+    for (unsigned I = 0; I < N->getNumElementSlots(); ++I) {
+      if (!N->hasMaterializedElement(I)) {
+        continue;
+      }
+      NodePtr E = N->getCompositeElement(I);
+      if (Summary->hasMaterializedElement(I)) {
+        joinInto(Summary->getCompositeElement(I), E, Joined);
+      }
+      else {
+        Summary->setCompositeElement(I, E);
+      }
+    }
+  }
+}
+
+}
+
+bool Graph::canFoldInto(const NodePtr &N, const NodePtr &Summary) {
+  // Only objects reached through plain pointers alone, anything naming N
+  // directly would keep seeing the old node
+  return !ReverseMapping.count(N.get()) && N != Return && !N->isThis()
+         && !MemAliases.hasAliasKind(N.get()) && !N->hasCopyEdges()
+         && N->getThisEdges().empty() && N->getNumWeakEdges() == 0
+         && !Summary->isInterned();
+}
+
+void Graph::limitRecursiveDepth(unsigned K) {
+  if (IsBottom) {
+    return;
+  }
+  DepthLimiter Limiter(K);
+  for (auto &Entry : Mapping) {
+    Limiter.addRoot(Entry.second.get());
+  }
+  if (Return) {
+    Limiter.addRoot(Return.get());
+  }
+  MemAliases.forEachThisNode([&Limiter](Node *N) { Limiter.addRoot(N); });
+  Limiter.run();
+
+  JoinedT Joined;
+  for (auto &Candidate : Limiter.Candidates) {
+    const NodePtr &N = Candidate.first;
+    const NodePtr &Summary = Candidate.second;
+    if (Limiter.Embedded.count(N.get()) || !canFoldInto(N, Summary)) {
+      continue;
+    }
+    if (!Summary->isSummary()) {
+      ++NumSummaryNodes;
+      Summary->markIsSummary();
+    }
+    joinInto(Summary, N, Joined);
+    ++NumFoldedNodes;
+    for (PointerNode *P : Limiter.Referrers[N.get()]) {
+      P->setPointee(Summary);
+    }
+  }
+}
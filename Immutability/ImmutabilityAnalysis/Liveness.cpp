@@ -0,0 +1,85 @@
+#include "Liveness.h"
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Instructions.h>
+
+using namespace llvm;
+using namespace immutability;
+
+Liveness::Liveness(const Function *F, const ValueSlots &Slots)
+    : Slots(Slots) {
+  unsigned NumSlots = Slots.size();
+
+  // Reads of values from other blocks and everything the block defines, PHI
+  // operands are read on the incoming edge instead
+  DenseMap<const BasicBlock *, BitVector> Uses;
+  DenseMap<const BasicBlock *, BitVector> Defs;
+  for (const BasicBlock &BB : *F) {
+    BitVector &U = Uses[&BB];
+    BitVector &D = Defs[&BB];
+    U.resize(NumSlots);
+    D.resize(NumSlots);
+    LiveIn[&BB].resize(NumSlots);
+    for (const Instruction &I : BB) {
+      D.set(Slots.getSlot(&I));
+      if (isa<PHINode>(I)) {
+        continue;
+      }
+      for (const Value *Op : I.operands()) {
+        if (auto OpI = dyn_cast<Instruction>(Op)) {
+          if (OpI->getParent() == &BB) {
+            continue;
+          }
+        }
+        else if (!isa<Argument>(Op)) {
+          continue;
+        }
+        unsigned Slot = Slots.getSlot(Op);
+        if (Slot != ValueSlots::None) {
+          U.set(Slot);
+        }
+      }
+    }
+  }
+
+  // Backwards over the blocks so most loops settle in two rounds
+  bool Changed = true;
+  BitVector Live(NumSlots);
+  while (Changed) {
+    Changed = false;
+    for (const BasicBlock &BB : reverse(*F)) {
+      Live.reset();
+      for (const BasicBlock *Succ : successors(&BB)) {
+        getLiveOnEdge(&BB, Succ, Live);
+      }
+      Live.reset(Defs[&BB]);
+      Live |= Uses[&BB];
+      BitVector &In = LiveIn[&BB];
+      if (In != Live) {
+        In = Live;
+        Changed = true;
+      }
+    }
+  }
+}
+
+void Liveness::addPHIUses(const BasicBlock *From, const BasicBlock *To,
+                          BitVector &Live) const {
+  for (const PHINode &PN : To->phis()) {
+    const Value *V = PN.getIncomingValueForBlock(From);
+    unsigned Slot = Slots.getSlot(V);
+    if (Slot != ValueSlots::None) {
+      Live.set(Slot);
+    }
+  }
+}
+
+void Liveness::getLiveOnEdge(const BasicBlock *From, const BasicBlock *To,
+                             BitVector &Live) const {
+  auto It = LiveIn.find(To);
+  assert(It != LiveIn.end());
+  Live.resize(Slots.size());
+  Live |= It->second;
+  addPHIUses(From, To, Live);
+}
@@ -0,0 +1,38 @@
+#ifndef LLVM_ANALYSIS_IMMUTABILITY_LIVENESS_H
+#define LLVM_ANALYSIS_IMMUTABILITY_LIVENESS_H
+
+#include "ValueSlots.h"
+
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/IR/BasicBlock.h>
+
+namespace llvm {
+namespace immutability {
+
+/* SSA liveness of one function over its value slots. A value is live on an
+ * edge if the successor or anything after it reads it, or if a PHI node of
+ * the successor takes it from this edge.
+ */
+class Liveness {
+  const ValueSlots &Slots;
+  DenseMap<const BasicBlock *, BitVector> LiveIn;
+
+  void addPHIUses(const BasicBlock *From, const BasicBlock *To,
+                  BitVector &Live) const;
+
+public:
+  Liveness(const Function *F, const ValueSlots &Slots);
+
+  const ValueSlots &getValueSlots() const {
+    return Slots;
+  }
+
+  void getLiveOnEdge(const BasicBlock *From, const BasicBlock *To,
+                     BitVector &Live) const;
+};
+
+}
+}
+
+#endif
@@ -6,6 +6,9 @@
 namespace llvm {
 namespace immutability {
 
+/* Buckets are sorted inline vectors of weak pointers like the edge sets of
+ * a node, lookups compare owners and iterating them allocates nothing.
+ */
 class MemoryAliases {
 public:
   enum class AliasKind {
@@ -15,10 +18,11 @@ public:
     UNKNOWN_ELEMENT,
   };
 
-  typedef DenseMap<const Type *, NodeWeakSetT> TypeNodesMap;
+  typedef EdgeSet<NodeWeakPtr, OwnerOrder, 4> AliasSetT;
+  typedef DenseMap<const Type *, AliasSetT> TypeNodesMap;
 
   typedef std::pair<const CompositeType *, unsigned> ElementPair;
-  typedef DenseMap<const Type*, DenseMap<ElementPair, NodeWeakSetT>>
+  typedef DenseMap<const Type*, DenseMap<ElementPair, AliasSetT>>
     TypeElementNodesMap;
 
 private:
@@ -88,6 +92,94 @@ public:
   std::vector<Node *> getWeakEdges(const Node *N) const;
   std::vector<std::shared_ptr<Node>> getWeakEdgesShared(const Node *N) const;
 
+  // Drops entries for nodes that are gone or not in Live, returns how many
+  unsigned prune(const DenseSet<const Node *> &Live) {
+    unsigned Removed = 0;
+    DenseSet<const Node *> Present;
+    auto PruneSet = [&](AliasSetT &S) {
+      Removed += S.eraseIf([&](const NodeWeakPtr &W) {
+        NodePtr N = W.lock();
+        if (!N || !Live.count(N.get())) {
+          return true;
+        }
+        Present.insert(N.get());
+        return false;
+      });
+      return S.empty();
+    };
+    auto PruneMap = [&](TypeNodesMap &M) {
+      for (auto It = M.begin(), E = M.end(); It != E;) {
+        auto Cur = It++;
+        if (PruneSet(Cur->second)) {
+          M.erase(Cur);
+        }
+      }
+    };
+    auto PruneElementMap = [&](TypeElementNodesMap &M) {
+      for (auto It = M.begin(), E = M.end(); It != E;) {
+        auto Cur = It++;
+        auto &Inner = Cur->second;
+        for (auto InnerIt = Inner.begin(), InnerE = Inner.end();
+             InnerIt != InnerE;) {
+          auto InnerCur = InnerIt++;
+          if (PruneSet(InnerCur->second)) {
+            Inner.erase(InnerCur);
+          }
+        }
+        if (Inner.empty()) {
+          M.erase(Cur);
+        }
+      }
+    };
+    PruneMap(Known);
+    PruneMap(Unknown);
+    PruneElementMap(KnownElement);
+    PruneElementMap(UnknownElement);
+
+    // Keyed by address, so only trust nodes still in one of the tables
+    for (auto It = Kinds.begin(), E = Kinds.end(); It != E;) {
+      auto Cur = It++;
+      if (!Present.count(Cur->first)) {
+        Kinds.erase(Cur);
+      }
+    }
+    for (auto It = Elements.begin(), E = Elements.end(); It != E;) {
+      auto Cur = It++;
+      if (!Present.count(Cur->first)) {
+        Elements.erase(Cur);
+      }
+    }
+    return Removed;
+  }
+
+  // Roots for garbage collection, this may only be reachable from here
+  template <typename FnT>
+  void forEachThisNode(FnT Fn) const {
+    auto Visit = [&Fn](const AliasSetT &S) {
+      for (const NodePtr &N : LiveNodeRange<AliasSetT>(S)) {
+        if (N->isThis()) {
+          Fn(N.get());
+        }
+      }
+    };
+    for (auto &Entry : Known) {
+      Visit(Entry.second);
+    }
+    for (auto &Entry : Unknown) {
+      Visit(Entry.second);
+    }
+    for (auto &Entry : KnownElement) {
+      for (auto &Inner : Entry.second) {
+        Visit(Inner.second);
+      }
+    }
+    for (auto &Entry : UnknownElement) {
+      for (auto &Inner : Entry.second) {
+        Visit(Inner.second);
+      }
+    }
+  }
+
   void clear() {
     Known.clear();
     Unknown.clear();
@@ -0,0 +1,38 @@
+#include "Graph.h"
+
+using namespace llvm;
+using namespace immutability;
+
+GraphPtr Graph::mergeDistinct(ArrayRef<const Graph *> Inputs) {
+  assert(!Inputs.empty() && "Nothing to merge");
+
+  // The same state twice, or two with the same stamp, adds nothing
+  SmallVector<const Graph *, 8> Distinct;
+  for (const Graph *G : Inputs) {
+    bool Seen = false;
+    for (const Graph *D : Distinct) {
+      if (D == G || (G->Stamp != 0 && G->Stamp == D->Stamp)) {
+        Seen = true;
+        break;
+      }
+    }
+    if (!Seen) {
+      Distinct.push_back(G);
+    }
+  }
+
+  if (Distinct.size() == 1) {
+    GraphPtr Ret = Distinct.front()->clone();
+    Ret->Stamp = Distinct.front()->Stamp;
+    return std::move(Ret);
+  }
+
+  // No n-ary join, this is a left fold over the pairwise merge. Each step
+  // builds a fresh graph, so the inputs never need a clone and only one
+  // intermediate result is alive at a time
+  GraphPtr Ret = merge(*Distinct[0], *Distinct[1]);
+  for (unsigned I = 2; I < Distinct.size(); ++I) {
+    Ret = merge(*Ret, *Distinct[I]);
+  }
+  return std::move(Ret);
+}
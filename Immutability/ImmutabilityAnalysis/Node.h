@@ -1,7 +1,12 @@
 #ifndef LLVM_ANALYSIS_IMMUTABILITY_NODE_H
 #define LLVM_ANALYSIS_IMMUTABILITY_NODE_H
 
+#include "EdgeSet.h"
+#include "IntRange.h"
+#include "NodeAllocator.h"
+
 #include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
 #include <llvm/ADT/SmallSet.h>
 #include <llvm/ADT/STLExtras.h>
 #include <llvm/IR/ConstantRange.h>
@@ -9,6 +14,8 @@
 #include <llvm/IR/Function.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <atomic>
+
 namespace llvm {
 
 namespace immutability {
@@ -52,21 +59,28 @@ public:
     SEQNK_NOT_NULL,
     SEQNK_MAYBE_NULL,
   };
-  typedef NodeSetT EdgeT;
-  typedef NodeWeakSetT EdgeWeakT;
+  typedef EdgeSet<NodePtr, PointerOrder> EdgeT;
+  typedef EdgeSet<NodeWeakPtr, OwnerOrder> EdgeWeakT;
 private:
   const NodeKind Kind;
 protected:
   const Type *Ty;
   bool IsThis;
   bool IsRead;
+  // Stands for any number of objects, so updates through it are weak
+  bool IsSummary = false;
+  // Shared by every graph of the thread, must never be changed
+  bool IsInterned = false;
   EdgeWeakT CopyEdges;
   EdgeT ThisEdges;
   EdgeWeakT WeakEdges;
 
+  // Mark of the last NodeWalker to visit this node
+  mutable uint64_t VisitEpoch = 0;
+
   Node(const Node &N)
       : Kind(N.Kind), Ty(N.Ty), IsThis(N.IsThis), IsRead(N.IsRead),
-        CopyEdges(N.CopyEdges), ThisEdges(N.ThisEdges),
+        IsSummary(N.IsSummary), CopyEdges(N.CopyEdges), ThisEdges(N.ThisEdges),
         WeakEdges(N.WeakEdges) {
   }
 
@@ -113,6 +127,19 @@ public:
   bool isPointer() const {
     return Kind == NK_POINTER;
   }
+  static uint64_t createVisitEpoch() {
+    static std::atomic<uint64_t> NextEpoch(1);
+    return NextEpoch++;
+  }
+  // Returns false if already visited in this epoch
+  bool markVisited(uint64_t Epoch) const {
+    if (VisitEpoch == Epoch) {
+      return false;
+    }
+    VisitEpoch = Epoch;
+    return true;
+  }
+
   bool isComposite() const {
     return Kind == NK_SEQUENTIAL || Kind == NK_STRUCT;
   }
@@ -154,12 +181,14 @@ public:
     return cast<PointerType>(Ty);
   }
 
+  // Element indices below this reach every element node, for arrays this
+  // is the tracked slot count and not the length of the type
   unsigned getCompositeNumElements() {
     if (isStruct()) {
       return getStructNumElements();
     }
     else if (isSequential()) {
-      return getSequentialNumElements();
+      return getNumElementSlots();
     }
     else {
       llvm_unreachable("Unknown composite type");
@@ -168,6 +197,11 @@ public:
   unsigned getSequentialNumElements() {
     return getSequentialType()->getNumElements();
   }
+  // Composite elements 0 to getNumElementSlots() - 1 reach every element
+  // node once, also for summarized arrays
+  unsigned getNumElementSlots();
+  // Like hasCompositeElement, never creates a field of a lazy this struct
+  bool hasMaterializedElement(unsigned I);
   unsigned getStructNumElements() {
     return getStructType()->getNumElements();
   }
@@ -230,20 +264,30 @@ public:
 
   static NodePtr createTopFromType(const Type *T);
   static NodePtr createThisFromType(const Type *T);
+  // One interned node per scalar type for values the analysis ignores
+  static NodePtr getUntrackedScalar(const Type *T);
 
-  bool isUnique() const { return WeakEdges.size() <= 1; }
-  bool isShared() const { return WeakEdges.size() > 1; }
+  bool isUnique() const { return !isShared(); }
+  bool isShared() const { return IsSummary || WeakEdges.size() > 1; }
+
+  bool isSummary() const {
+    return IsSummary;
+  }
+  void markIsSummary() {
+    assert(!IsInterned && "Interned nodes are immutable");
+    IsSummary = true;
+  }
 
   bool hasCopyEdges() const {
     return CopyEdges.size() > 0;
   }
-  bool isCopyEdge(NodePtr &N) const {
+  bool isCopyEdge(const NodePtr &N) const {
     return CopyEdges.count(N) > 0;
   }
-  bool isThisEdge(NodePtr &N) const {
+  bool isThisEdge(const NodePtr &N) const {
     return ThisEdges.count(N) > 0;
   }
-  bool isWeakEdge(NodePtr &N) const {
+  bool isWeakEdge(const NodePtr &N) const {
     return WeakEdges.count(N) > 0;
   }
   unsigned getNumWeakEdges() const { return WeakEdges.size(); }
@@ -259,14 +303,37 @@ public:
     WeakEdges.clear();
   }
 
-  void addCopyEdge(NodePtr N) { CopyEdges.insert(N); }
-  void addThisEdge(NodePtr N) { ThisEdges.insert(N); }
-  void addWeakEdge(NodePtr N) { WeakEdges.insert(N); }
+  void addCopyEdge(NodePtr N) {
+    assert(!IsInterned && "Interned nodes are immutable");
+    CopyEdges.insert(N);
+  }
+  void addThisEdge(NodePtr N) {
+    assert(!IsInterned && "Interned nodes are immutable");
+    ThisEdges.insert(N);
+  }
+  void addWeakEdge(NodePtr N) {
+    assert(!IsInterned && "Interned nodes are immutable");
+    WeakEdges.insert(N);
+  }
 
   void removeCopyEdge(NodePtr N) { CopyEdges.erase(N); }
   void removeWeakEdge(NodePtr N) { WeakEdges.erase(N); }
 
+  void compactEdges() {
+    CopyEdges.compact();
+    WeakEdges.compact();
+  }
+  // Drops copy and weak edges to nodes that are gone or not in Live
+  unsigned pruneEdges(const DenseSet<const Node *> &Live) {
+    auto IsDead = [&Live](const NodeWeakPtr &W) {
+      NodePtr N = W.lock();
+      return !N || !Live.count(N.get());
+    };
+    return CopyEdges.eraseIf(IsDead) + WeakEdges.eraseIf(IsDead);
+  }
+
   void setIsThis() {
+    assert(!IsInterned && "Interned nodes are immutable");
     IsThis = true;
   }
   void setIsRead() {
@@ -275,7 +342,11 @@ public:
     }
   }
 
-  const ConstantRange &getIntConstantRange() const;
+  bool isInterned() const {
+    return IsInterned;
+  }
+
+  ConstantRange getIntConstantRange() const;
   void setIntConstantRange(ConstantRange CR);
 
   bool hasPointerPointee() const;
@@ -313,6 +384,7 @@ public:
   void top();
 
   void unionWith(const Node &N) {
+    assert(!IsInterned && "Interned nodes are immutable");
     if (IsThis && N.IsThis) { IsThis = true; }
     else                    { IsThis = false; }
     if (IsRead && N.IsRead) { IsRead = true; }
@@ -373,22 +445,27 @@ public:
   static void getReachable(NodeSetT &S, NodePtr N);
   static NodeSetT getReachable(NodePtr N);
 
+  // Live copy and weak nodes without collecting them into a set, the edges
+  // must not change while iterating
+  LiveNodeRange<EdgeWeakT> copyNodes() const {
+    return LiveNodeRange<EdgeWeakT>(CopyEdges);
+  }
+  LiveNodeRange<EdgeWeakT> weakNodes() const {
+    return LiveNodeRange<EdgeWeakT>(WeakEdges);
+  }
+
   NodeSetT getCopyNodes() const {
     NodeSetT S;
-    for (auto NW : getCopyEdges()) {
-      if (auto N = NW.lock()) {
-        S.insert(N);
-      }
+    for (const NodePtr &N : copyNodes()) {
+      S.insert(N);
     }
     return S;
   }
 
   NodeSetT getWeakNodes() const {
     NodeSetT S;
-    for (auto NW : getWeakEdges()) {
-      if (auto N = NW.lock()) {
-        S.insert(N);
-      }
+    for (const NodePtr &N : weakNodes()) {
+      S.insert(N);
     }
     return S;
   }
@@ -418,7 +495,7 @@ public:
   //void dumpAll(unsigned Indent) const override { dump(); errs() << '\n'; }
 
   static FloatingPointNodePtr createUninitialized(const Type *T) {
-    return std::make_shared<FloatingPointNode>(T);
+    return makeNode<FloatingPointNode>(T);
   }
 };
 
@@ -443,49 +520,74 @@ public:
   }
 
   static FunctionNodePtr createUninitialized(const Type *T) {
-    auto N = std::make_shared<FunctionNode>(T);
+    auto N = makeNode<FunctionNode>(T);
     N->Uninitialized = true;
     return std::move(N);
   }
 
   static FunctionNodePtr createInitialized(const Function *F) {
-    return std::make_shared<FunctionNode>(F);
+    return makeNode<FunctionNode>(F);
   }
 };
 
+// InternedNodes.cpp
+// Constants are interned only while this is on. It stays off for now:
+// Graph::refineInt, refineBool and update change the node of an operand in
+// place instead of mapping a private copy first, which an interned node
+// must never see.
+bool internsConstants();
+void setInternsConstants(bool B);
+// Puts a private copy in place of every interned node reachable from Root,
+// so the nodes can be marked afterwards
+void uninternReachable(const NodePtr &Root);
+
 class IntNode : public Node {
 private:
-  ConstantRange Range;
+  IntRange Range;
 public:
-  IntNode(const IntNode &N) : Node(N), Range(N.Range) {}
+  // A copy of an interned node is an ordinary node again
+  IntNode(const IntNode &N) : Node(N), Range(N.Range) {
+    IsInterned = false;
+  }
   explicit IntNode(const IntegerType *T)
       : Node(NK_INT, T), Range(T->getBitWidth(), true) {}
 
-  const ConstantRange& getConstantRange() const { return Range; }
-  void setConstantRange(ConstantRange CR) { Range = CR; }
+  ConstantRange getConstantRange() const { return Range.toConstantRange(); }
+  void setConstantRange(ConstantRange CR) {
+    setRange(IntRange(CR));
+  }
+  const IntRange &getRange() const { return Range; }
+  void setRange(const IntRange &R) {
+    assert(!IsInterned && "Interned nodes are immutable");
+    Range = R;
+  }
 
   static bool classof(const Node *N) { return N->getKind() == NK_INT; }
 
   static IntNodePtr createUninitialized(const IntegerType *T) {
-    return std::make_shared<IntNode>(T);
+    return makeNode<IntNode>(T);
   }
 
   static IntNodePtr createRange(const IntegerType *T, ConstantRange CR) {
     assert(T->getBitWidth() == CR.getBitWidth()
            && "Integer bitwidths need to match");
-    auto N = std::make_shared<IntNode>(T);
-    N->Range = CR;
+    auto N = makeNode<IntNode>(T);
+    N->Range = IntRange(CR);
     return std::move(N);
   }
 
+  static IntNodePtr createInterned(const ConstantInt *CI);
   static IntNodePtr createFromConstant(const ConstantInt *CI) {
-    auto N = std::make_shared<IntNode>(CI->getType());
-    N->Range = ConstantRange(CI->getValue());
+    if (internsConstants()) {
+      return createInterned(CI);
+    }
+    auto N = makeNode<IntNode>(CI->getType());
+    N->Range = IntRange(CI->getValue());
     return std::move(N);
   }
 
   IntNodePtr cloneNoEdges() {
-    return std::make_shared<IntNode>(*this);
+    return makeNode<IntNode>(*this);
   }
 
   bool isUninitialized() const {
@@ -493,48 +595,44 @@ public:
   }
 
   bool isFalse() const {
-    if (Range.isSingleElement()) {
-      if (Range.getLower().getBoolValue() == false) {
-        return true;
-      }
-    }
-    return false;
+    return Range.isFalse();
   }
   bool isTrue() const {
-    if (Range.isSingleElement()) {
-      if (Range.getLower().getBoolValue() == true) {
-        return true;
-      }
-    }
-    return false;
+    return Range.isTrue();
   }
   void mergeWith(const IntNode &N) { // TODO REMOVE
+    assert(!IsInterned && "Interned nodes are immutable");
     if (N.IsRead) {
       IsRead = true;
     }
     Range = Range.unionWith(N.Range);
   }
   void strongUpdate(const IntNode &N) {
+    assert(!IsInterned && "Interned nodes are immutable");
     // TODO: Should this copy the edges, what about read?
     IsRead = N.IsRead;
     Range = N.Range;
   }
   void unionWith(const IntNode &N) { // TODO REMOVE
+    assert(!IsInterned && "Interned nodes are immutable");
     if (N.IsRead) {
       IsRead = true;
     }
     Range = Range.unionWith(N.Range);
   }
   void intersect(ConstantRange CR) {
-    Range = Range.intersectWith(CR);
+    assert(!IsInterned && "Interned nodes are immutable");
+    Range = Range.intersectWith(IntRange(CR));
   }
 
   void refine(ConstantRange CR) {
-    if (Range.contains(CR)) {
-      Range = CR;
+    assert(!IsInterned && "Interned nodes are immutable");
+    IntRange R(CR);
+    if (Range.contains(R)) {
+      Range = R;
     }
     else {
-      Range = ConstantRange(Range.getBitWidth(), false);
+      Range = IntRange(Range.getBitWidth(), false);
     }
   }
 
@@ -704,61 +802,114 @@ public:
 
   static PointerNodePtr createNull(const Type *T) {
     assert(isa<SequentialType>(T) || isa<PointerType>(T));
-    PointerNodePtr P = std::make_shared<PointerNode>(T);
+    PointerNodePtr P = makeNode<PointerNode>(T);
     P->markOnlyNull();
     return std::move(P);
   }
 
   static PointerNodePtr createUninitialized(const Type *T) {
     assert(isa<SequentialType>(T) || isa<PointerType>(T));
-    PointerNodePtr P = std::make_shared<PointerNode>(T);
+    PointerNodePtr P = makeNode<PointerNode>(T);
     return std::move(P);
   }
 
   static PointerNodePtr createPointee(NodePtr N) {
-    PointerNodePtr P = std::make_shared<PointerNode>(N->getType()->getPointerTo());
+    PointerNodePtr P = makeNode<PointerNode>(N->getType()->getPointerTo());
     P->Pointee = N;
     P->NullKind = SEQNK_NOT_NULL;
     return std::move(P);
   }
 };
 
+/* Arrays longer than MaxTrackedElements keep their first elements apart and
+ * fold all the others into one summary element in the last slot, so a
+ * char buf[65536] costs as much to clone, merge and compare as a short one.
+ * The summary element is marked as a summary, so it is shared and the store
+ * transfer updates it weakly.
+ */
 class SequentialNode : public Node {
   std::vector<std::shared_ptr<Node>> Elements;
+
+  static unsigned getNumSlots(const SequentialType *T) {
+    uint64_t NumElements = T->getNumElements();
+    if (NumElements > MaxTrackedElements) {
+      return MaxTrackedElements + 1;
+    }
+    return NumElements;
+  }
+
 public:
+  static const unsigned MaxTrackedElements = 16;
+
   explicit SequentialNode(const SequentialType *T)
-      : Node(NK_SEQUENTIAL, T), Elements(T->getNumElements()) {
+      : Node(NK_SEQUENTIAL, T), Elements(getNumSlots(T)) {
   }
  SequentialNode(const SequentialNode &N)
    : Node(N), Elements(N.Elements) {
   }
   static bool classof(const Node *N) { return N->getKind() == NK_SEQUENTIAL; }
 
+  unsigned getNumSlots() const {
+    return Elements.size();
+  }
+  bool isSummarized() const {
+    return Elements.size() > MaxTrackedElements;
+  }
+  unsigned getSlot(unsigned Index) const {
+    return Index < MaxTrackedElements ? Index : MaxTrackedElements;
+  }
+
   bool hasElement(unsigned Index) const {
-    return Elements[Index] != nullptr;
+    return Elements[getSlot(Index)] != nullptr;
   }
   std::shared_ptr<Node> getElement(unsigned Index) const {
-    return Elements[Index];
+    return Elements[getSlot(Index)];
   }
   void setElement(unsigned Index, const std::shared_ptr<Node> &Element) {
-    Elements[Index] = Element;
+    unsigned Slot = getSlot(Index);
+    if (isSummarized() && Slot == MaxTrackedElements && Element
+        && !Element->isInterned()) {
+      Element->markIsSummary();
+    }
+    Elements[Slot] = Element;
+  }
+  // Slot numbers as from getSlot, no summary marking
+  std::shared_ptr<Node> getSlotElement(unsigned Slot) const {
+    return Elements[Slot];
+  }
+  void setSlotElement(unsigned Slot, const std::shared_ptr<Node> &Element) {
+    Elements[Slot] = Element;
   }
 
   static std::shared_ptr<SequentialNode> createUninitialized(const SequentialType *T) {
-    return std::make_shared<SequentialNode>(T);
+    return makeNode<SequentialNode>(T);
   }
 };
 
+
+/* A lazy this struct leaves its fields unset until they are asked for, an
+ * unset field stands for an untouched this of its type. Walks, clones and
+ * merges only see the fields methods have actually reached. A field created
+ * on one node is shared with its copy nodes and weakly linked to the same
+ * field of its weak nodes, as if it had always been there.
+ */
 class StructNode : public Node {
   mutable std::vector<NodePtr> Fields;
   NodePtr SubStruct;
+  bool IsLazyThis = false;
+
+  NodePtr materializeThisField(unsigned Index) const;
+  typedef function_ref<bool(const Node *)> IsAliasedT;
+  static bool isUntouchedThis(const NodePtr &N, IsAliasedT IsAliased);
+
 public:
   StructNode(const StructType *T)
       : Node(NK_STRUCT, T), Fields(T->getNumElements()) {
   }
 
   StructNode(const StructNode &N)
-      : Node(N), Fields(N.Fields), SubStruct(N.SubStruct) {
+      : Node(N), Fields(N.Fields), SubStruct(N.SubStruct),
+        IsLazyThis(N.IsLazyThis) {
   }
 
   static bool classof(const Node *N) { return N->getKind() == NK_STRUCT; }
@@ -775,6 +926,12 @@ public:
     assert(Index < getNumFields());
     return Fields[Index] != nullptr;
   }
+  // An unset field of a lazy this struct is not missing, it is an untouched
+  // this of the field's type that getElement creates on demand. Walkers
+  // that only follow hasElement have to treat it as such.
+  bool isImplicitThis(unsigned Index) const {
+    return IsLazyThis && Index < getNumFields() && Fields[Index] == nullptr;
+  }
   NodePtr getField(unsigned Index) const {
     errs() << "TODO: Remove getField\n";
     /*
@@ -809,6 +966,9 @@ public:
     return Fields[Index];
   }
   NodePtr getElement(unsigned Index) const {
+    if (isImplicitThis(Index)) {
+      Fields[Index] = materializeThisField(Index);
+    }
     return Fields[Index];
   }
   void setElement(unsigned Index, const std::shared_ptr<Node> &N) {
@@ -818,6 +978,13 @@ public:
     Fields[Index] = N;
   }
 
+  bool isLazyThis() const {
+    return IsLazyThis;
+  }
+  // Unsets the fields that are still an untouched this, returns how many.
+  // IsAliased tells whether an alias bucket of the graph holds a node.
+  unsigned recollapse(IsAliasedT IsAliased);
+
   void clearFields() {
     for (unsigned Index = 0; Index < getNumFields(); ++Index) {
       Fields[Index] = nullptr;
@@ -836,10 +1003,114 @@ public:
   }
 
   static StructNodePtr createUninitialized(const StructType *T) {
-    return std::make_shared<StructNode>(T);
+    return makeNode<StructNode>(T);
+  }
+  static StructNodePtr createLazyThis(const StructType *T) {
+    StructNodePtr N = makeNode<StructNode>(T);
+    N->setIsThis();
+    N->IsLazyThis = true;
+    return N;
   }
 };
 
+inline NodePtr StructNode::materializeThisField(unsigned Index) const {
+  // A copy that already has the field shares it
+  for (const NodePtr &CN : copyNodes()) {
+    auto CS = dyn_cast<StructNode>(CN.get());
+    if (CS && CS->hasElement(Index)
+        && !CS->Fields[Index]->isInterned()) {
+      NodePtr N = CS->Fields[Index];
+      if (IsThis) {
+        N->setIsThis();
+      }
+      return N;
+    }
+  }
+
+  Type *ElementTy = cast<StructType>(Ty)->getElementType(Index);
+  NodePtr N;
+  if (auto ST = dyn_cast<StructType>(ElementTy)) {
+    N = createLazyThis(ST);
+  }
+  else {
+    N = Node::createThisFromType(ElementTy);
+  }
+  if (IsRead) {
+    N->setIsRead();
+  }
+  for (const NodePtr &CN : copyNodes()) {
+    if (auto CS = dyn_cast<StructNode>(CN.get())) {
+      CS->Fields[Index] = N;
+    }
+  }
+  // Carry any weak edges
+  for (const NodePtr &WN : weakNodes()) {
+    auto WS = dyn_cast<StructNode>(WN.get());
+    if (WS && WS->hasElement(Index)
+        && !WS->Fields[Index]->isInterned()) {
+      Node::addWeakEdge(WS->Fields[Index], N);
+    }
+  }
+  return N;
+}
+
+inline unsigned Node::getNumElementSlots() {
+  if (auto SN = dyn_cast<SequentialNode>(this)) {
+    return SN->getNumSlots();
+  }
+  return getStructNumElements();
+}
+
+inline bool Node::hasMaterializedElement(unsigned I) {
+  if (auto SN = dyn_cast<StructNode>(this)) {
+    return SN->hasElement(I);
+  }
+  return hasCompositeElement(I);
+}
+
+// Whether the field node N could be unset without losing anything: only its
+// struct holds it and it carries nothing an implicit field would not. Does
+// not change any node.
+inline bool StructNode::isUntouchedThis(const NodePtr &N,
+                                        IsAliasedT IsAliased) {
+  if (N.use_count() != 1 || IsAliased(N.get())) {
+    return false;
+  }
+  if (!N->isThis() || N->isRead() || N->isSummary() || N->hasCopyEdges()
+      || N->getNumWeakEdges() != 0 || !N->getThisEdges().empty()) {
+    return false;
+  }
+  if (auto SN = dyn_cast<StructNode>(N.get())) {
+    if (!SN->IsLazyThis || SN->hasSubStruct()) {
+      return false;
+    }
+    for (const NodePtr &F : SN->Fields) {
+      if (F && !isUntouchedThis(F, IsAliased)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  if (auto IN = dyn_cast<IntNode>(N.get())) {
+    return IN->isUninitialized();
+  }
+  return N->getKind() == NK_FLOATING_POINT;
+}
+
+inline unsigned StructNode::recollapse(IsAliasedT IsAliased) {
+  if (!IsLazyThis) {
+    return 0;
+  }
+  unsigned NumCollapsed = 0;
+  for (NodePtr &F : Fields) {
+    if (F && isUntouchedThis(F, IsAliased)) {
+      F = nullptr;
+      ++NumCollapsed;
+    }
+  }
+  return NumCollapsed;
+}
+
 __attribute__((always_inline))
 inline
 bool hasSingleNode(NodeToNodeSetT &Map, const Node *Key) {
@@ -0,0 +1,148 @@
+#include "NodeAllocator.h"
+
+#include <llvm/Support/Mutex.h>
+
+#include <atomic>
+#include <cstdlib>
+
+using namespace llvm;
+using namespace immutability;
+
+namespace {
+
+const size_t NumClasses = pool::MaxSize / pool::Granularity;
+const size_t SlabSize = 64 * 1024;
+
+struct FreeBlock {
+  FreeBlock *Next;
+};
+
+size_t getClass(size_t Size) {
+  return (Size + pool::Granularity - 1) / pool::Granularity - 1;
+}
+
+// Free lists left behind by threads that exited. HasOrphans lets a thread
+// whose own list ran dry skip the lock when there is nothing to adopt, it is
+// only written with OrphanMutex held.
+sys::SmartMutex<false> OrphanMutex;
+FreeBlock *Orphans[NumClasses];
+std::atomic<bool> HasOrphans[NumClasses];
+
+size_t getBlockSize(size_t Class) {
+  return (Class + 1) * pool::Granularity;
+}
+
+// Nodes can still be freed by other thread_local destructors that run after
+// the cache of their thread is gone, those go through the orphan lists
+thread_local bool CacheDestroyed = false;
+
+class ThreadCache {
+  FreeBlock *Free[NumClasses] = {};
+  char *Cur = nullptr;
+  char *End = nullptr;
+
+  bool adoptOrphans(size_t Class) {
+    if (!HasOrphans[Class].load(std::memory_order_relaxed)) {
+      return false;
+    }
+    OrphanMutex.lock();
+    Free[Class] = Orphans[Class];
+    Orphans[Class] = nullptr;
+    HasOrphans[Class].store(false, std::memory_order_relaxed);
+    OrphanMutex.unlock();
+    return Free[Class] != nullptr;
+  }
+
+public:
+  ~ThreadCache() {
+    CacheDestroyed = true;
+    OrphanMutex.lock();
+    for (size_t Class = 0; Class < NumClasses; ++Class) {
+      FreeBlock *Last = Free[Class];
+      if (!Last) {
+        continue;
+      }
+      while (Last->Next) {
+        Last = Last->Next;
+      }
+      Last->Next = Orphans[Class];
+      Orphans[Class] = Free[Class];
+      Free[Class] = nullptr;
+      HasOrphans[Class].store(true, std::memory_order_relaxed);
+    }
+    OrphanMutex.unlock();
+  }
+
+  void *allocate(size_t Size) {
+    size_t Class = getClass(Size);
+    if (Free[Class] || adoptOrphans(Class)) {
+      FreeBlock *B = Free[Class];
+      Free[Class] = B->Next;
+      return B;
+    }
+    size_t BlockSize = getBlockSize(Class);
+    if (static_cast<size_t>(End - Cur) < BlockSize) {
+      // The tail of the old slab is too small for this class, drop it
+      Cur = static_cast<char *>(::operator new(SlabSize));
+      End = Cur + SlabSize;
+    }
+    void *P = Cur;
+    Cur += BlockSize;
+    return P;
+  }
+
+  void deallocate(void *P, size_t Size) {
+    size_t Class = getClass(Size);
+    FreeBlock *B = static_cast<FreeBlock *>(P);
+    B->Next = Free[Class];
+    Free[Class] = B;
+  }
+};
+
+thread_local ThreadCache Cache;
+
+void *allocateOrphan(size_t Size) {
+  size_t Class = getClass(Size);
+  OrphanMutex.lock();
+  FreeBlock *B = Orphans[Class];
+  if (B) {
+    Orphans[Class] = B->Next;
+    HasOrphans[Class].store(Orphans[Class] != nullptr,
+                            std::memory_order_relaxed);
+  }
+  OrphanMutex.unlock();
+  if (B) {
+    return B;
+  }
+  // Blocks are never returned to the heap, so this one can join any free
+  // list of its class later
+  return ::operator new(getBlockSize(Class));
+}
+
+// A block can sit in the middle of a slab, so it cannot be deleted
+void deallocateOrphan(void *P, size_t Size) {
+  size_t Class = getClass(Size);
+  FreeBlock *B = static_cast<FreeBlock *>(P);
+  OrphanMutex.lock();
+  B->Next = Orphans[Class];
+  Orphans[Class] = B;
+  HasOrphans[Class].store(true, std::memory_order_relaxed);
+  OrphanMutex.unlock();
+}
+
+}
+
+void *pool::allocate(size_t Size) {
+  if (CacheDestroyed) {
+    return allocateOrphan(Size);
+  }
+  return Cache.allocate(Size);
+}
+
+void pool::deallocate(void *P, size_t Size) {
+  if (CacheDestroyed) {
+    deallocateOrphan(P, Size);
+    return;
+  }
+  Cache.deallocate(P, Size);
+}
@@ -0,0 +1,72 @@
+#ifndef LLVM_ANALYSIS_IMMUTABILITY_NODE_ALLOCATOR_H
+#define LLVM_ANALYSIS_IMMUTABILITY_NODE_ALLOCATOR_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+
+namespace llvm {
+namespace immutability {
+
+/* Size-classed free lists for node allocations. Every clone of a graph
+ * allocates all of its nodes again, and the workers of the thread pool all
+ * do so at the same time, so the global heap is a point of contention.
+ *
+ * Each thread allocates from its own slabs and free lists without locking.
+ * A block freed on another thread simply joins that thread's free list, and
+ * the lists of an exiting thread are handed over to the next thread to run
+ * out. Slabs are never returned. Blocks freed or allocated on a thread
+ * whose cache is already destroyed go straight to the shared lists.
+ */
+namespace pool {
+
+const size_t Granularity = 16;
+const size_t MaxSize = 256;
+
+void *allocate(size_t Size);
+void deallocate(void *P, size_t Size);
+
+}
+
+template <typename T>
+class NodeAllocator {
+public:
+  typedef T value_type;
+
+  NodeAllocator() = default;
+  template <typename U>
+  NodeAllocator(const NodeAllocator<U> &) {}
+
+  T *allocate(size_t N) {
+    size_t Size = N * sizeof(T);
+    if (alignof(T) > pool::Granularity || Size > pool::MaxSize) {
+      return static_cast<T *>(::operator new(Size));
+    }
+    return static_cast<T *>(pool::allocate(Size));
+  }
+  void deallocate(T *P, size_t N) {
+    size_t Size = N * sizeof(T);
+    if (alignof(T) > pool::Granularity || Size > pool::MaxSize) {
+      ::operator delete(P);
+      return;
+    }
+    pool::deallocate(P, Size);
+  }
+
+  template <typename U>
+  bool operator==(const NodeAllocator<U> &) const { return true; }
+  template <typename U>
+  bool operator!=(const NodeAllocator<U> &) const { return false; }
+};
+
+/* The node and its reference counts share one pooled block */
+template <typename T, typename... ArgTs>
+std::shared_ptr<T> makeNode(ArgTs &&... Args) {
+  return std::allocate_shared<T>(NodeAllocator<T>(),
+                                 std::forward<ArgTs>(Args)...);
+}
+
+}
+}
+
+#endif
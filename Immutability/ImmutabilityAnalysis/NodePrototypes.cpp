@@ -0,0 +1,110 @@
+#include "NodePrototypes.h"
+
+using namespace llvm;
+using namespace immutability;
+
+bool NodePrototypes::isCopyable(const Node &N) {
+  if (N.hasCopyEdges() || !N.getThisEdges().empty()
+      || N.weakNodes().begin() != N.weakNodes().end()) {
+    return false;
+  }
+  switch (N.getKind()) {
+  case Node::NK_FLOATING_POINT:
+  case Node::NK_FUNCTION:
+  case Node::NK_INT:
+    return true;
+  case Node::NK_POINTER: {
+    auto &P = cast<PointerNode>(N);
+    if (!P.hasPointee()) {
+      return true;
+    }
+    // Held by the pointer and the copy returned by getPointee
+    NodePtr Pointee = P.getPointee();
+    return Pointee.use_count() == 2 && isCopyable(*Pointee);
+  }
+  case Node::NK_SEQUENTIAL: {
+    auto &SN = cast<SequentialNode>(N);
+    for (unsigned I = 0; I < SN.getNumSlots(); ++I) {
+      NodePtr E = SN.getSlotElement(I);
+      if (E && (E.use_count() != 2 || !isCopyable(*E))) {
+        return false;
+      }
+    }
+    return true;
+  }
+  case Node::NK_STRUCT: {
+    auto &SN = cast<StructNode>(N);
+    if (SN.hasSubStruct() || SN.isLazyThis()) {
+      return false;
+    }
+    for (unsigned I = 0; I < SN.getNumFields(); ++I) {
+      if (SN.hasElement(I) && (SN.getElement(I).use_count() != 2
+                               || !isCopyable(*SN.getElement(I)))) {
+        return false;
+      }
+    }
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+NodePtr NodePrototypes::copy(const Node &N) {
+  switch (N.getKind()) {
+  case Node::NK_FLOATING_POINT:
+    return makeNode<FloatingPointNode>(cast<FloatingPointNode>(N));
+  case Node::NK_FUNCTION:
+    return makeNode<FunctionNode>(cast<FunctionNode>(N));
+  case Node::NK_INT:
+    return makeNode<IntNode>(cast<IntNode>(N));
+  case Node::NK_POINTER: {
+    auto P = makeNode<PointerNode>(cast<PointerNode>(N));
+    if (P->hasPointee()) {
+      P->setPointee(copy(*P->getPointee()));
+    }
+    return P;
+  }
+  case Node::NK_SEQUENTIAL: {
+    // Slot by slot, an element copy would otherwise go through the summary
+    // handling of setElement
+    auto SN = makeNode<SequentialNode>(cast<SequentialNode>(N));
+    for (unsigned I = 0; I < SN->getNumSlots(); ++I) {
+      if (NodePtr E = SN->getSlotElement(I)) {
+        SN->setSlotElement(I, copy(*E));
+      }
+    }
+    return SN;
+  }
+  case Node::NK_STRUCT: {
+    auto SN = makeNode<StructNode>(cast<StructNode>(N));
+    for (unsigned I = 0; I < SN->getNumFields(); ++I) {
+      if (SN->hasElement(I)) {
+        SN->setField(I, copy(*SN->getElement(I)));
+      }
+    }
+    return SN;
+  }
+  default:
+    llvm_unreachable("Prototype is not copyable");
+  }
+}
+
+NodePtr NodePrototypes::get(const Type *T, bool IsThis) {
+  auto &Prototypes = IsThis ? ThisPrototypes : TopPrototypes;
+  Mutex.lock();
+  auto It = Prototypes.find(T);
+  if (It == Prototypes.end()) {
+    NodePtr N = IsThis ? Node::createThisFromType(T)
+                       : Node::createTopFromType(T);
+    It = Prototypes.insert(std::make_pair(T, isCopyable(*N) ? N : nullptr))
+             .first;
+  }
+  // Prototypes never change once built
+  NodePtr Prototype = It->second;
+  Mutex.unlock();
+  if (!Prototype) {
+    return IsThis ? Node::createThisFromType(T) : Node::createTopFromType(T);
+  }
+  return copy(*Prototype);
+}
@@ -0,0 +1,44 @@
+#ifndef LLVM_ANALYSIS_IMMUTABILITY_NODE_PROTOTYPES_H
+#define LLVM_ANALYSIS_IMMUTABILITY_NODE_PROTOTYPES_H
+
+#include "Node.h"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Support/Mutex.h>
+
+namespace llvm {
+namespace immutability {
+
+/* The top and this subgraphs of a type, built once from the type and then
+ * copied node by node for every later request. Copying a tree of nodes skips
+ * the walk over the LLVM type and its layout queries.
+ *
+ * Nodes are updated in place all over the analysis, so each request gets
+ * its own copy; the prototypes are never handed out. A prototype that is
+ * not a plain tree without edges is not kept and the type is built from
+ * scratch every time.
+ */
+class NodePrototypes {
+  sys::SmartMutex<false> Mutex;
+  // A null prototype means the type can't be copied this way
+  DenseMap<const Type *, NodePtr> TopPrototypes;
+  DenseMap<const Type *, NodePtr> ThisPrototypes;
+
+  static bool isCopyable(const Node &N);
+  static NodePtr copy(const Node &N);
+
+  NodePtr get(const Type *T, bool IsThis);
+
+public:
+  NodePtr createTop(const Type *T) {
+    return get(T, false);
+  }
+  NodePtr createThis(const Type *T) {
+    return get(T, true);
+  }
+};
+
+}
+}
+
+#endif
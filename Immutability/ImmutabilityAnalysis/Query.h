@@ -1,18 +1,100 @@
 #ifndef LLVM_ANALYSIS_IMMUTABILITY_QUERY
 #define LLVM_ANALYSIS_IMMUTABILITY_QUERY
 
+#include "AccessedFields.h"
 #include "ClassQuery.h"
+#include "Liveness.h"
 #include "MemQuery.h"
+#include "NodePrototypes.h"
+#include "UntrackedScalars.h"
+#include "ValueSlots.h"
+
+#include <llvm/Support/Mutex.h>
 
 namespace llvm {
 namespace immutability {
 
+enum class Precision {
+  Fast,    // Path-insensitive, no integer ranges, no ignored edge splitting
+  Precise,
+};
+
 class Query {
+  sys::SmartMutex<false> SlotsMutex;
+  DenseMap<const Function *, std::unique_ptr<ValueSlots>> Slots;
+  sys::SmartMutex<false> LivenessMutex;
+  DenseMap<const Function *, std::unique_ptr<Liveness>> Live;
+  sys::SmartMutex<false> ScalarsMutex;
+  DenseMap<const Function *, std::unique_ptr<UntrackedScalars>> Scalars;
+
 public:
   ClassQuery &C;
   MemQuery &M;
 
-  Query(ClassQuery &C, MemQuery &M) : C(C), M(M) {}
+  Precision Mode;
+  const AccessedFields *Accessed;
+  // Structs with at least this many fields only keep accessed ones, 0 is off
+  unsigned WideStructFields;
+  bool LazyThis;
+  bool UsePrototypes;
+  bool ElideScalars;
+  NodePrototypes Prototypes;
+  bool CollectGarbage;
+  bool PruneDeadValues;
+  // Pointer depth kept apart for recursive types, 0 is unlimited
+  unsigned RecursiveDepthLimit;
+
+  Query(ClassQuery &C, MemQuery &M)
+      : C(C), M(M), Mode(Precision::Precise),
+        Accessed(nullptr), WideStructFields(0), LazyThis(false),
+        UsePrototypes(false), ElideScalars(false), CollectGarbage(false), PruneDeadValues(false),
+        RecursiveDepthLimit(0) {}
+
+  bool isPathSensitive() const {
+    return Mode == Precision::Precise;
+  }
+  bool tracksIntRanges() const {
+    return Mode == Precision::Precise;
+  }
+  bool splitsIgnoredEdges() const {
+    return Mode == Precision::Precise;
+  }
+
+  // Numbered on first use, the numbering never changes afterwards
+  const ValueSlots &getValueSlots(const Function *F) {
+    SlotsMutex.lock();
+    auto &S = Slots[F];
+    if (!S) {
+      S = make_unique<ValueSlots>(F);
+    }
+    const ValueSlots &Ret = *S;
+    SlotsMutex.unlock();
+    return Ret;
+  }
+
+  const Liveness &getLiveness(const Function *F) {
+    const ValueSlots &S = getValueSlots(F);
+    LivenessMutex.lock();
+    auto &L = Live[F];
+    if (!L) {
+      L = make_unique<Liveness>(F, S);
+    }
+    const Liveness &Ret = *L;
+    LivenessMutex.unlock();
+    return Ret;
+  }
+
+  const UntrackedScalars &getUntrackedScalars(const Function *F) {
+    const ValueSlots &S = getValueSlots(F);
+    ScalarsMutex.lock();
+    auto &U = Scalars[F];
+    if (!U) {
+      U = make_unique<UntrackedScalars>(F, S);
+    }
+    const UntrackedScalars &Ret = *U;
+    ScalarsMutex.unlock();
+    return Ret;
+  }
 
   bool isIgnoredInst(const Instruction *I) {
     return C.isIgnoredInst(I) || M.isIgnoredInst(I);
@@ -0,0 +1,59 @@
+#include "Reachability.h"
+
+#include "Traversal.h"
+
+using namespace llvm;
+using namespace immutability;
+
+ReachabilityIndex::ReachabilityIndex(ArrayRef<Node *> Roots) {
+  // Escapes are found along the edges of Node::getReachable, the derived
+  // object behind a base struct is not reached through it
+  NodeChildren Children(false);
+  NodeWalker<> Walker(Children);
+  for (Node *R : Roots) {
+    Walker.addRoot(R);
+  }
+  Walker.run([this](Node *N) {
+    Index[N] = Nodes.size();
+    Nodes.push_back(N);
+    return true;
+  });
+
+  ThisNodes.resize(Nodes.size());
+  EdgeBegin.reserve(Nodes.size() + 1);
+  for (unsigned I = 0; I < Nodes.size(); ++I) {
+    Node *N = Nodes[I];
+    if (N->isThis() || !N->getThisEdges().empty()) {
+      ThisNodes.set(I);
+    }
+    EdgeBegin.push_back(Edges.size());
+    Children(N, [this](Node *C) { Edges.push_back(Index[C]); });
+  }
+  EdgeBegin.push_back(Edges.size());
+}
+
+BitVector ReachabilityIndex::getReachable(ArrayRef<Node *> Sources) const {
+  BitVector Reachable(Nodes.size());
+  std::vector<unsigned> Frontier;
+  for (Node *S : Sources) {
+    auto It = Index.find(S);
+    assert(It != Index.end() && "Source not reachable from the roots");
+    unsigned I = It->second;
+    if (!Reachable.test(I)) {
+      Reachable.set(I);
+      Frontier.push_back(I);
+    }
+  }
+  while (!Frontier.empty()) {
+    unsigned I = Frontier.back();
+    Frontier.pop_back();
+    for (unsigned E = EdgeBegin[I]; E < EdgeBegin[I + 1]; ++E) {
+      unsigned C = Edges[E];
+      if (!Reachable.test(C)) {
+        Reachable.set(C);
+        Frontier.push_back(C);
+      }
+    }
+  }
+  return Reachable;
+}
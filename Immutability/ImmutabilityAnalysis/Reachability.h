@@ -0,0 +1,55 @@
+#ifndef LLVM_ANALYSIS_IMMUTABILITY_REACHABILITY_H
+#define LLVM_ANALYSIS_IMMUTABILITY_REACHABILITY_H
+
+#include "Node.h"
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
+
+#include <vector>
+
+namespace llvm {
+namespace immutability {
+
+/* Numbers the nodes reachable from a set of roots densely, with the edges
+ * Node::getReachable follows in flat arrays, so reachability from any group of sources is
+ * a bit vector over node numbers and questions like "does it reach this"
+ * are word operations against a precomputed mask.
+ */
+class ReachabilityIndex {
+  DenseMap<const Node *, unsigned> Index;
+  std::vector<Node *> Nodes;
+  std::vector<unsigned> EdgeBegin;
+  std::vector<unsigned> Edges;
+
+  // Nodes that are part of this or have this edges
+  BitVector ThisNodes;
+
+public:
+  explicit ReachabilityIndex(ArrayRef<Node *> Roots);
+
+  unsigned size() const {
+    return Nodes.size();
+  }
+  Node *getNode(unsigned I) const {
+    return Nodes[I];
+  }
+
+  // The sources have to be reachable from the roots
+  BitVector getReachable(ArrayRef<Node *> Sources) const;
+
+  bool isReachable(const BitVector &Reachable, const Node *N) const {
+    auto It = Index.find(N);
+    return It != Index.end() && Reachable.test(It->second);
+  }
+
+  bool reachesThis(const BitVector &Reachable) const {
+    return Reachable.anyCommon(ThisNodes);
+  }
+};
+
+}
+}
+
+#endif
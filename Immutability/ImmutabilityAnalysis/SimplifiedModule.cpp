@@ -0,0 +1,52 @@
+#include "SimplifiedModule.h"
+
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/ValueHandle.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/Local.h>
+#include <llvm/Transforms/Utils/PromoteMemToReg.h>
+
+using namespace llvm;
+using namespace immutability;
+
+SimplifiedModule::SimplifiedModule(const Module &Original) {
+  Copy = CloneModule(Original, VMap);
+  for (Function &F : Copy->functions()) {
+    if (F.empty()) {
+      continue;
+    }
+    simplify(F);
+  }
+  C.runOnModule(*Copy);
+  M.runOnModule(*Copy);
+}
+
+void SimplifiedModule::simplify(Function &F) {
+  std::vector<AllocaInst *> Allocas;
+  for (Instruction &I : F.getEntryBlock()) {
+    if (auto AI = dyn_cast<AllocaInst>(&I)) {
+      if (isAllocaPromotable(AI)) {
+        Allocas.push_back(AI);
+      }
+    }
+  }
+  if (!Allocas.empty()) {
+    // Turns the dbg.declare of each alloca into dbg.values
+    DominatorTree DT(F);
+    PromoteMemToReg(Allocas, DT);
+  }
+
+  SmallVector<WeakTrackingVH, 16> Dead;
+  for (Instruction &I : instructions(F)) {
+    if (isInstructionTriviallyDead(&I)) {
+      Dead.push_back(&I);
+    }
+  }
+  for (WeakTrackingVH &V : Dead) {
+    if (V) {
+      RecursivelyDeleteTriviallyDeadInstructions(V);
+    }
+  }
+}
@@ -0,0 +1,49 @@
+#ifndef LLVM_ANALYSIS_IMMUTABILITY_SIMPLIFIED_MODULE_H
+#define LLVM_ANALYSIS_IMMUTABILITY_SIMPLIFIED_MODULE_H
+
+#include "ClassQuery.h"
+#include "MemQuery.h"
+
+#include <llvm/IR/Module.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+namespace llvm {
+namespace immutability {
+
+/* A private copy of the module with the stack temporaries of debug builds
+ * promoted to registers and trivially dead code removed. The copy keeps all
+ * the debug info, and gets its own ClassQuery and MemQuery since those are
+ * keyed by the instructions of the module they ran on. The clone map is kept
+ * to get from an original function to its copy.
+ */
+class SimplifiedModule {
+  std::unique_ptr<Module> Copy;
+  ValueToValueMapTy VMap;
+
+  ClassQuery C;
+  MemQuery M;
+
+  static void simplify(Function &F);
+
+public:
+  explicit SimplifiedModule(const Module &Original);
+
+  Module &getModule() {
+    return *Copy;
+  }
+  ClassQuery &getClassQuery() {
+    return C;
+  }
+  MemQuery &getMemQuery() {
+    return M;
+  }
+
+  const Function *getSimplified(const Function *Original) const {
+    return cast_or_null<Function>(VMap.lookup(Original));
+  }
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef LLVM_ANALYSIS_IMMUTABILITY_TRAVERSAL_H
+#define LLVM_ANALYSIS_IMMUTABILITY_TRAVERSAL_H
+
+#include "Node.h"
+
+#include <llvm/ADT/SmallVector.h>
+
+namespace llvm {
+namespace immutability {
+
+// The edges a node owns: its pointee, its composite elements, or the full
+// derived object a base struct hangs off. Without FollowSubStruct these are
+// the edges of Node::getReachable.
+struct NodeChildren {
+  bool FollowSubStruct;
+
+  explicit NodeChildren(bool FollowSubStruct = true)
+      : FollowSubStruct(FollowSubStruct) {}
+
+  template <typename PushT>
+  void operator()(Node *N, PushT Push) const {
+    if (N->isPointer()) {
+      if (N->hasPointerPointee()) {
+        Push(N->getPointerPointee().get());
+      }
+    }
+    else if (N->isComposite()) {
+      for (unsigned I = 0; I < N->getNumElementSlots(); ++I) {
+        if (N->hasMaterializedElement(I)) {
+          Push(N->getCompositeElement(I).get());
+        }
+      }
+      if (auto SN = dyn_cast<StructNode>(N)) {
+        if (FollowSubStruct && SN->hasSubStruct()) {
+          Push(SN->getSubStruct().get());
+        }
+      }
+    }
+  }
+};
+
+/* Visits each node reachable from the roots once, depth first on an
+ * explicit stack, so deep structures cannot overflow the call stack.
+ *
+ * Visited nodes are marked with an epoch unique to the walk instead of
+ * being collected in a set. A node carries one mark, so walks over the
+ * same nodes must not be nested.
+ */
+template <typename ChildrenT = NodeChildren>
+class NodeWalker {
+  uint64_t Epoch;
+  SmallVector<Node *, 32> Stack;
+  ChildrenT Children;
+
+public:
+  explicit NodeWalker(ChildrenT C = ChildrenT())
+      : Epoch(Node::createVisitEpoch()), Children(C) {}
+
+  void addRoot(Node *N) {
+    if (N->markVisited(Epoch)) {
+      Stack.push_back(N);
+    }
+  }
+
+  // Visit returns whether to go on into the children of the node
+  template <typename VisitT>
+  void run(VisitT Visit) {
+    while (!Stack.empty()) {
+      Node *N = Stack.pop_back_val();
+      if (Visit(N)) {
+        Children(N, [this](Node *C) { addRoot(C); });
+      }
+    }
+  }
+};
+
+}
+}
+
+#endif
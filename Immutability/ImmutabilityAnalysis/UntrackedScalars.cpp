@@ -0,0 +1,68 @@
+#include "UntrackedScalars.h"
+
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+
+using namespace llvm;
+using namespace immutability;
+
+bool UntrackedScalars::isScalarOp(const Instruction &I) {
+  Type *T = I.getType();
+  if (!T->isIntegerTy() && !T->isFloatingPointTy()) {
+    return false;
+  }
+  if (isa<BinaryOperator>(I) || isa<SelectInst>(I) || isa<PHINode>(I)) {
+    return true;
+  }
+  if (isa<CmpInst>(I)) {
+    return !I.getOperand(0)->getType()->isPointerTy();
+  }
+  if (isa<CastInst>(I)) {
+    return !isa<PtrToIntInst>(I) && !isa<IntToPtrInst>(I)
+           && !isa<BitCastInst>(I);
+  }
+  return false;
+}
+
+UntrackedScalars::UntrackedScalars(const Function *F, const ValueSlots &Slots)
+    : Slots(Slots), Untracked(Slots.size()) {
+  // Everything read by anything else is tracked, and so are the operands of
+  // tracked scalar operations
+  BitVector Tracked(Slots.size());
+  SmallVector<const Instruction *, 32> Worklist;
+  auto Track = [&](const Value *V) {
+    auto OpI = dyn_cast<Instruction>(V);
+    if (!OpI) {
+      return;
+    }
+    unsigned Slot = Slots.getSlot(OpI);
+    if (Slot == ValueSlots::None || Tracked.test(Slot)) {
+      return;
+    }
+    Tracked.set(Slot);
+    if (isScalarOp(*OpI)) {
+      Worklist.push_back(OpI);
+    }
+  };
+  for (const Instruction &I : instructions(F)) {
+    if (isScalarOp(I)) {
+      continue;
+    }
+    for (const Value *Op : I.operands()) {
+      Track(Op);
+    }
+  }
+  while (!Worklist.empty()) {
+    const Instruction *I = Worklist.pop_back_val();
+    for (const Value *Op : I->operands()) {
+      Track(Op);
+    }
+  }
+
+  for (const Instruction &I : instructions(F)) {
+    unsigned Slot = Slots.getSlot(&I);
+    if (isScalarOp(I) && !Tracked.test(Slot)) {
+      Untracked.set(Slot);
+    }
+  }
+}
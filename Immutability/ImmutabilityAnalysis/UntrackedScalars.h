@@ -0,0 +1,36 @@
+#ifndef LLVM_ANALYSIS_IMMUTABILITY_UNTRACKED_SCALARS_H
+#define LLVM_ANALYSIS_IMMUTABILITY_UNTRACKED_SCALARS_H
+
+#include "ValueSlots.h"
+
+#include <llvm/ADT/BitVector.h>
+#include <llvm/IR/Instruction.h>
+
+namespace llvm {
+namespace immutability {
+
+/* The integer and floating point instructions of one function whose values
+ * only ever flow into other such instructions. None of them reaches a branch,
+ * memory, a call, an address or the return value, so the analysis can give
+ * them all one shared node without computing anything.
+ */
+class UntrackedScalars {
+  const ValueSlots &Slots;
+  BitVector Untracked;
+
+public:
+  UntrackedScalars(const Function *F, const ValueSlots &Slots);
+
+  // Arithmetic, compares, selects, PHIs and casts between scalars
+  static bool isScalarOp(const Instruction &I);
+
+  bool isUntracked(const Instruction &I) const {
+    unsigned Slot = Slots.getSlot(&I);
+    return Slot != ValueSlots::None && Untracked.test(Slot);
+  }
+};
+
+}
+}
+
+#endif
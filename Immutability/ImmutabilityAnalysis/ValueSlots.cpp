@@ -0,0 +1,17 @@
+#include "ValueSlots.h"
+
+#include <llvm/IR/InstIterator.h>
+
+using namespace llvm;
+using namespace immutability;
+
+ValueSlots::ValueSlots(const Function *F) {
+  for (const Argument &A : F->args()) {
+    unsigned Slot = Slots.size();
+    Slots[&A] = Slot;
+  }
+  for (const Instruction &I : instructions(F)) {
+    unsigned Slot = Slots.size();
+    Slots[&I] = Slot;
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef LLVM_ANALYSIS_IMMUTABILITY_VALUE_SLOTS_H
+#define LLVM_ANALYSIS_IMMUTABILITY_VALUE_SLOTS_H
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/IR/Function.h>
+
+namespace llvm {
+namespace immutability {
+
+/* Numbers the arguments and then the instructions of one function densely
+ * from 0, so per-value facts of a function can live in bit vectors and flat
+ * arrays instead of maps keyed by the value.
+ */
+class ValueSlots {
+  DenseMap<const Value *, unsigned> Slots;
+
+public:
+  explicit ValueSlots(const Function *F);
+
+  static const unsigned None = ~0U;
+
+  unsigned size() const {
+    return Slots.size();
+  }
+  unsigned getSlot(const Value *V) const {
+    auto It = Slots.find(V);
+    if (It == Slots.end()) {
+      return None;
+    }
+    return It->second;
+  }
+};
+
+}
+}
+
+#endif
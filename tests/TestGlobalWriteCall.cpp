@@ -0,0 +1,24 @@
+class Registry;
+
+Registry *Last;
+
+static void remember(Registry *R) { Last = R; }
+
+class Registry {
+private:
+   int count;
+public:
+   Registry() { count = 0; }
+   // The block with the call must not be taken from the block cache, the
+   // callee lets this escape through a global the block never names
+   int publish() const {
+      int c = count;
+      remember(const_cast<Registry *>(this));
+      return c;
+   }
+};
+
+int main() {
+   Registry R;
+   return R.publish();
+}
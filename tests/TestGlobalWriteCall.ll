@@ -0,0 +1,48 @@
+; ModuleID = 'TestGlobalWriteCall.cpp'
+source_filename = "TestGlobalWriteCall.cpp"
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+%class.Registry = type { i32 }
+
+@Last = dso_local global %class.Registry* null, align 8
+
+$_ZN8RegistryC2Ev = comdat any
+
+$_ZNK8Registry7publishEv = comdat any
+
+; Function Attrs: norecurse uwtable
+define dso_local i32 @main() #0 {
+entry:
+  %R = alloca %class.Registry, align 4
+  call void @_ZN8RegistryC2Ev(%class.Registry* %R)
+  %call = call i32 @_ZNK8Registry7publishEv(%class.Registry* %R)
+  ret i32 %call
+}
+
+; Function Attrs: nounwind uwtable
+define linkonce_odr dso_local void @_ZN8RegistryC2Ev(%class.Registry* %this) unnamed_addr #1 comdat align 2 {
+entry:
+  %count = getelementptr inbounds %class.Registry, %class.Registry* %this, i32 0, i32 0
+  store i32 0, i32* %count, align 4
+  ret void
+}
+
+; Function Attrs: nounwind uwtable
+define linkonce_odr dso_local i32 @_ZNK8Registry7publishEv(%class.Registry* %this) #1 comdat align 2 {
+entry:
+  %count = getelementptr inbounds %class.Registry, %class.Registry* %this, i32 0, i32 0
+  %0 = load i32, i32* %count, align 4
+  call void @_ZL8rememberP8Registry(%class.Registry* %this)
+  ret i32 %0
+}
+
+; Function Attrs: nounwind uwtable
+define internal void @_ZL8rememberP8Registry(%class.Registry* %R) #1 {
+entry:
+  store %class.Registry* %R, %class.Registry** @Last, align 8
+  ret void
+}
+
+attributes #0 = { norecurse uwtable }
+attributes #1 = { nounwind uwtable }